@@ -0,0 +1,197 @@
+/*
+ * Host side simulation harness and benchmark of the i2c driver.
+ *
+ * Runs an AVR firmware on simavr with a set of TWI slave models
+ * attached to its TWI master. Models are given in the command line:
+ *
+ *   sim_i2c firmware model:addr[:stretch_us] ...
+ *
+ * where model is one of reg, eeprom, nack or stretch (see
+ * twi_models.h). The firmware divides its run in phases by writing
+ * the phase number (1..15) to PORTB; 0 ends the current phase and
+ * 0xff is ignored. For each phase the harness reports:
+ *
+ *  - transactions per second (START conditions, repeated included)
+ *  - data bytes per second
+ *  - cycles spent in TWI_vect per data byte
+ *
+ * Phase time includes the time stretched by Stretch models.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "sim_irq.h"
+#include "sim_interrupts.h"
+#include "avr_twi.h"
+#include "avr_ioport.h"
+#include "twi_models.h"
+
+
+#define MCU        "atmega328p"
+#define FREQ       16000000
+#define TWI_VECTOR 24          // TWI_vect number in atmega328p
+#define MAX_MODELS 8
+#define MAX_PHASES 16
+
+
+static avr_t *avr;
+
+static twi_model_t models[MAX_MODELS];
+static int n_models;
+
+/* phases accounting */
+static struct {
+  uint64_t begin, end;       // cycles
+  uint64_t stretched;        // cycles stretched by models
+  uint32_t starts;           // START conditions
+  uint32_t bytes;            // data bytes
+  uint64_t isr;              // cycles in TWI_vect
+} phases[MAX_PHASES];
+static int cur;              // current phase, 0 if none
+static uint64_t isr_begin;   // cycle TWI_vect began
+
+
+
+static uint64_t stretched(void) {
+  uint64_t s = 0;
+
+  for (int i = 0; i < n_models; i++) s += models[i].stretched;
+  return s;
+}
+
+
+/* counts conditions and bytes driven by the master */
+static void bus_hook(struct avr_irq_t *irq, uint32_t value, void *param) {
+  avr_twi_msg_irq_t v;
+
+  (void)irq; (void)param;
+  v.u.v = value;
+  if (!cur) return;
+  if (v.u.twi.msg & TWI_COND_START)
+    phases[cur].starts++;
+  if (v.u.twi.msg & (TWI_COND_WRITE | TWI_COND_READ))
+    phases[cur].bytes++;
+}
+
+
+/* accounts TWI_vect execution time */
+static void isr_hook(struct avr_irq_t *irq, uint32_t value, void *param) {
+  (void)irq; (void)param;
+  if (value) {
+    isr_begin = avr->cycle;
+  } else if (cur) {
+    phases[cur].isr += avr->cycle - isr_begin;
+  }
+}
+
+
+/* firmware phase changes */
+static void phase_hook(struct avr_irq_t *irq, uint32_t value, void *param) {
+  (void)irq; (void)param;
+  value &= 0xff;
+  if (value == 0xff) return;
+  if (cur) {
+    phases[cur].end = avr->cycle;
+    phases[cur].stretched = stretched() - phases[cur].stretched;
+  }
+  cur = (value < MAX_PHASES) ? value : 0;
+  if (cur) {
+    memset(&phases[cur], 0, sizeof(phases[cur]));
+    phases[cur].begin = avr->cycle;
+    phases[cur].stretched = stretched();
+  }
+}
+
+
+static int parse_model(const char *arg) {
+  static const struct {const char *name; twi_model_kind_t kind;} kinds[] = {
+    {"reg", Reg}, {"eeprom", Eeprom}, {"nack", Nack}, {"stretch", Stretch},
+  };
+  char name[16];
+  int addr;
+  unsigned stretch = 0;
+
+  if (n_models == MAX_MODELS ||
+      sscanf(arg, "%15[a-z]:%i:%u", name, &addr, &stretch) < 2)
+    return -1;
+  for (unsigned i = 0; i < sizeof(kinds)/sizeof(kinds[0]); i++) {
+    if (!strcmp(name, kinds[i].name)) {
+      twi_model_init(avr, &models[n_models], kinds[i].kind, addr, stretch);
+      twi_model_attach(&models[n_models++]);
+      return 0;
+    }
+  }
+  return -1;
+}
+
+
+static void report(void) {
+  printf("%5s %12s %12s %12s %10s\n",
+	 "phase", "trans/s", "bytes/s", "isr cyc/B", "ms");
+  for (int p = 1; p < MAX_PHASES; p++) {
+    const double cycles =
+      phases[p].end - phases[p].begin + phases[p].stretched;
+    const double secs = cycles / avr->frequency;
+
+    if (!phases[p].begin) continue;
+    printf("%5d %12.1f %12.1f %12.1f %10.2f\n",
+	   p,
+	   phases[p].starts / secs,
+	   phases[p].bytes / secs,
+	   phases[p].bytes ? (double)phases[p].isr / phases[p].bytes : 0.0,
+	   secs * 1000);
+  }
+}
+
+
+int main(int argc, char *argv[]) {
+  elf_firmware_t f;
+  int state;
+
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s firmware model:addr[:stretch_us] ...\n",
+	    argv[0]);
+    return 1;
+  }
+
+  memset(&f, 0, sizeof(f));
+  if (elf_read_firmware(argv[1], &f)) {
+    fprintf(stderr, "%s: cannot load firmware %s\n", argv[0], argv[1]);
+    return 1;
+  }
+  avr = avr_make_mcu_by_name(MCU);
+  if (!avr) {
+    fprintf(stderr, "%s: unknown mcu %s\n", argv[0], MCU);
+    return 1;
+  }
+  avr_init(avr);
+  avr_load_firmware(avr, &f);
+  if (!avr->frequency) avr->frequency = FREQ;
+
+  for (int i = 2; i < argc; i++) {
+    if (parse_model(argv[i])) {
+      fprintf(stderr, "%s: bad model %s\n", argv[0], argv[i]);
+      return 1;
+    }
+  }
+
+  avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_TWI_GETIRQ(0),
+					TWI_IRQ_OUTPUT),
+			  bus_hook, NULL);
+  avr_irq_register_notify(avr_get_interrupt_irq(avr, TWI_VECTOR) +
+			  AVR_INT_IRQ_RUNNING,
+			  isr_hook, NULL);
+  avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'),
+					IOPORT_IRQ_PIN_ALL),
+			  phase_hook, NULL);
+
+  do {
+    state = avr_run(avr);
+  } while (state != cpu_Done && state != cpu_Crashed);
+
+  report();
+  return state == cpu_Crashed;
+}
@@ -0,0 +1,135 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "sim_avr.h"
+#include "sim_time.h"
+#include "avr_twi.h"
+#include "twi_models.h"
+
+
+#define REG_SIZE     256
+#define EE_SIZE      (32*1024)
+#define EE_PAGE      64
+#define EE_WRITE_US  5000
+
+
+static const char *irq_names[2] = {
+  [TWI_IRQ_INPUT]  = "8>twi_model.out",
+  [TWI_IRQ_OUTPUT] = "32<twi_model.in",
+};
+
+
+/* answers to the master */
+static void reply(twi_model_t *m, uint8_t msg, uint8_t data) {
+  avr_raise_irq(m->irq + TWI_IRQ_INPUT,
+		avr_twi_irq_msg(msg, m->selected, data));
+}
+
+
+/* true iff the model acknowledges its address right now */
+static int answers(const twi_model_t *m) {
+  switch (m->kind) {
+  case Nack:   return 0;
+  case Eeprom: return m->avr->cycle >= m->busy_until;
+  default:     return 1;
+  }
+}
+
+
+/* a data byte written by the master */
+static void write_byte(twi_model_t *m, uint8_t b) {
+  if (m->kind == Eeprom) {
+    if (m->index < 2) {
+      // memory address, big endian
+      m->ptr = (m->index == 0) ? b << 8 : (m->ptr | b);
+      m->ptr &= EE_SIZE - 1;
+    } else {
+      // page write: address wraps around inside the page
+      m->mem[m->ptr] = b;
+      m->ptr = (m->ptr & ~(EE_PAGE-1)) | ((m->ptr + 1) & (EE_PAGE-1));
+    }
+  } else {
+    if (m->index == 0) {
+      m->ptr = b;
+    } else {
+      m->mem[m->ptr] = b;
+      m->ptr = (m->ptr + 1) % m->size;
+    }
+  }
+  m->index++;
+}
+
+
+/* the master requests a data byte */
+static uint8_t read_byte(twi_model_t *m) {
+  uint8_t b = m->mem[m->ptr];
+
+  m->ptr = (m->ptr + 1) % m->size;
+  return b;
+}
+
+
+static void in_hook(struct avr_irq_t *irq, uint32_t value, void *param) {
+  twi_model_t *m = (twi_model_t *)param;
+  avr_twi_msg_irq_t v;
+
+  (void)irq;
+  v.u.v = value;
+
+  if (v.u.twi.msg & TWI_COND_STOP) {
+    // a write to an EEPROM page starts its write cycle
+    if (m->selected && m->kind == Eeprom &&
+	!(m->selected & 1) && m->index > 2)
+      m->busy_until = m->avr->cycle +
+	avr_usec_to_cycles(m->avr, EE_WRITE_US);
+    m->selected = 0;
+  }
+
+  if (v.u.twi.msg & TWI_COND_START) {
+    m->selected = 0;
+    m->index = 0;
+    if ((v.u.twi.addr >> 1) == m->addr && answers(m)) {
+      m->selected = v.u.twi.addr;
+      reply(m, TWI_COND_ACK, 1);
+    }
+  }
+
+  if (!m->selected) return;
+
+  if (v.u.twi.msg & TWI_COND_WRITE) {
+    write_byte(m, v.u.twi.data);
+    reply(m, TWI_COND_ACK, 1);
+    if (m->kind == Stretch) m->stretched += m->stretch;
+  }
+
+  if (v.u.twi.msg & TWI_COND_READ) {
+    reply(m, TWI_COND_READ, read_byte(m));
+    if (m->kind == Stretch) m->stretched += m->stretch;
+  }
+}
+
+
+void twi_model_init(avr_t *avr, twi_model_t *m,
+		    twi_model_kind_t kind, uint8_t addr, uint32_t stretch) {
+  memset(m, 0, sizeof(*m));
+  m->kind = kind;
+  m->addr = addr;
+  m->avr = avr;
+  m->size = (kind == Eeprom) ? EE_SIZE : REG_SIZE;
+  m->mem = malloc(m->size);
+  memset(m->mem, 0xff, m->size);
+  m->stretch = avr_usec_to_cycles(avr, stretch);
+
+  m->irq = avr_alloc_irq(&avr->irq_pool, 0, 2, irq_names);
+  avr_irq_register_notify(m->irq + TWI_IRQ_OUTPUT, in_hook, m);
+}
+
+
+void twi_model_attach(twi_model_t *m) {
+  avr_connect_irq(m->irq + TWI_IRQ_INPUT,
+		  avr_io_getirq(m->avr, AVR_IOCTL_TWI_GETIRQ(0),
+				TWI_IRQ_INPUT));
+  avr_connect_irq(avr_io_getirq(m->avr, AVR_IOCTL_TWI_GETIRQ(0),
+				TWI_IRQ_OUTPUT),
+		  m->irq + TWI_IRQ_OUTPUT);
+}
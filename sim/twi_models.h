@@ -0,0 +1,58 @@
+#ifndef _TWI_MODELS_H_
+#define _TWI_MODELS_H_
+
+/*
+ * simavr models of TWI slave devices.
+ *
+ * Models are attached to the TWI master of a simulated AVR and answer
+ * to their 7 bit address:
+ *
+ *  - Reg:     a register file of 256 bytes. The first byte written
+ *             sets the register pointer; next bytes are written and
+ *             read at auto-incremented addresses.
+ *  - Eeprom:  a 24LC256 like EEPROM: 16 bit memory address, 64 byte
+ *             pages and a 5 ms write cycle during which the device
+ *             does not acknowledge its address.
+ *  - Nack:    a device that never acknowledges its address.
+ *  - Stretch: a register file that stretches the clock a given time
+ *             after every byte.
+ *
+ * simavr resolves every TWI byte synchronously and has no SCL line
+ * model. Thus stretching cannot delay the master: the stretch time
+ * of the Stretch model is accounted and must be added to the
+ * simulated time (see twi_model_t::stretched).
+ */
+
+#include <stdint.h>
+#include "sim_avr.h"
+#include "sim_irq.h"
+
+
+typedef enum { Reg, Eeprom, Nack, Stretch } twi_model_kind_t;
+
+
+typedef struct {
+  twi_model_kind_t kind;
+  uint8_t addr;             /* 7 bit address */
+  avr_t *avr;
+  avr_irq_t *irq;           /* model irqs: TWI_IRQ_INPUT and OUTPUT */
+  uint8_t selected;         /* SLA+R/W byte iff addressed, else 0 */
+  uint8_t index;            /* bytes written in this transfer */
+  uint16_t ptr;             /* register or memory pointer */
+  uint8_t *mem;
+  uint32_t size;
+  uint64_t busy_until;      /* Eeprom: write cycle end (cycles) */
+  uint32_t stretch;         /* Stretch: cycles stretched per byte */
+  uint64_t stretched;       /* Stretch: total cycles stretched */
+} twi_model_t;
+
+
+/* Creates a model of `kind` at `addr`. `stretch` in us (Stretch only) */
+void twi_model_init(avr_t *avr, twi_model_t *m,
+		    twi_model_kind_t kind, uint8_t addr, uint32_t stretch);
+
+/* Connects the model to the TWI master of `avr` */
+void twi_model_attach(twi_model_t *m);
+
+
+#endif
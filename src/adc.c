@@ -6,15 +6,15 @@
  */
 
 #include <stdint.h>
+#include <stddef.h>
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <util/atomic.h>
+#include <avr/sleep.h>
 #include "alert.h"
 #include "adc.h"
 
 
-/* number of samples in oversampling (2's power) */
-#define N_SAMPLES (UINT8_C(1<<2))
-
 /* remember last channel used */
 static adc_channel last_channel_used;
 
@@ -26,15 +26,21 @@ static struct {
   int n_other:4;
 } incompatible_refs = {0,0};
 
+/* waits for pending oversampled conversions (see below) */
+static void os_drain(void);
+/* restarts pending oversampled conversions (see below) */
+static void os_resume(void);
+
 
 /*
  * adc_channel internal representation:
  * - bits [0-3] hardware channel number
- * - bits [4-5] reserved
+ * - bit  [4]   resolution: 1 iff 10 bits
+ * - bit  [5]   reserved
  * - bits [6-7] voltage reference
  *
  *  bit  7 6 5 4 3 2 1 0
- *       R R - - C C C C
+ *       R R - S C C C C
  */
 
 /*
@@ -44,9 +50,16 @@ static struct {
 #define G_RE(x) (x>>6)                    /* get reference voltage */
 #define M_CH(x) (x & 017)                 /* masked channel number */
 #define M_RE(x) (x & 0300)                /* masked reference voltage */
+#define M_RS(x) (x & ADC_10BIT)           /* masked resolution */
 #define C_ADC(c,r) (c|r<<6)               /* adc_channel constructor */
 
 
+/* ADMUX setting to convert channel `ch` */
+static uint8_t admux(adc_channel ch) {
+  return M_RE(ch) | (M_RS(ch) ? 0 : _BV(ADLAR)) | M_CH(ch);
+}
+
+
 
 adc_channel adc_bind(uint8_t ch, adc_ref ref) {
   /* manage references compatibility */
@@ -60,8 +73,8 @@ adc_channel adc_bind(uint8_t ch, adc_ref ref) {
     incompatible_refs.n_other++;
   }    
   /* disable digital port if needed */
-  if (ch < 6)
-    DIDR0 |= _BV(ch);
+  if (G_CH(ch) < 6)
+    DIDR0 |= _BV(G_CH(ch));
   /* return external repr of adc channel */
   return C_ADC(ch,ref);
 }
@@ -75,14 +88,17 @@ void adc_unbind(adc_channel *const ch) {
     incompatible_refs.n_other--;
   }    
   /* enable digital port if needed */
-  if (*ch < 6)
-    DIDR0 &= ~_BV(*ch);
+  if (G_CH(*ch) < 6)
+    DIDR0 &= ~_BV(G_CH(*ch));
 }
 
 
 
 void adc_prepare(adc_channel ch) {
   bool discard_first_conversion = false;
+
+  /* oversampling owns the adc meanwhile */
+  os_drain();
   
   /* test if same enviroment that last conversion */
   if (ch != last_channel_used) {
@@ -97,6 +113,13 @@ void adc_prepare(adc_channel ch) {
       ADMUX = (ADMUX &  0360) | M_CH(ch);
       /* wait if needed */
     } 
+    if (M_RS(ch) != M_RS(last_channel_used)) {
+      /* 8 bits are read from ADCH alone: left adjust them */
+      if (M_RS(ch))
+        ADMUX &= ~_BV(ADLAR);
+      else
+        ADMUX |= _BV(ADLAR);
+    }
     /* update last conversion */
     last_channel_used = ch;
   }
@@ -114,6 +137,7 @@ void adc_prepare(adc_channel ch) {
 
 
 void adc_start_conversion(void) {
+  os_drain();
   /* avoid overreads or wait initial null conversion */
   while (ADCSRA & _BV(ADSC));
 
@@ -136,6 +160,11 @@ bool adc_converting(void) {
 uint8_t adc_get(void) {
   return ADCH;  // only 8 higher bits
 }
+
+
+uint16_t adc_get16(void) {
+  return ADC;   // right adjusted 10 bits
+}
  
 
 uint8_t adc_prep_start_get(adc_channel ch)
@@ -146,54 +175,500 @@ uint8_t adc_prep_start_get(adc_channel ch)
 }
 
 
+uint16_t adc_prep_start_get16(adc_channel ch)
+{
+  adc_prepare_start(ch);
+  while (adc_converting());
+  return adc_get16();
+}
+
 
 
 /*********************************************************
- * Oversampling read
+ * Sleeping conversions
  *********************************************************/
-static uint16_t sample_sum;
-static uint8_t num_samples;
+
+/*
+ * Noise reduction mode stops the I/O clock. Sleep in idle mode instead
+ * while it is needed: the usart may be receiving (it can not be told),
+ * a frame is waiting or being shifted out (TXC0 is cleared by the
+ * serial module on every byte loaded), the ticker is counting, since
+ * Timer2 is clocked synchronously and would lose ticks, or the TWI
+ * master is moving a request (its interrupt is enabled meanwhile).
+ */
+static bool io_clock_needed(void) {
+  return (UCSR0B & (_BV(RXEN0) | _BV(UDRIE0)))
+    || ((UCSR0B & _BV(TXEN0)) && !(UCSR0A & _BV(TXC0)))
+    || (TCCR2B & (_BV(CS22) | _BV(CS21) | _BV(CS20)))
+    || (TWCR & _BV(TWIE));
+}
 
 
-void adc_start_oversample(void) {
-  sample_sum = 0;
-  num_samples = 0;
-  /* enable trigger mode and enable interrupts */
-  ADCSRA |= _BV(ADATE) | _BV(ADIE);
+/*
+ * Sleeps until current conversion, if any, ends. Any interrupt wakes
+ * up the CPU, so it sleeps again while conversion is not done.
+ * The flag is tested with interrupts disabled: `sei` delays them
+ * until `sleep` is executed, so the ending of conversion can not be
+ * missed between the test and the sleep.
+ */
+static void sleep_while_converting(void) {
+  /* no interrupts: nothing would wake us up */
+  if (!(SREG & _BV(SREG_I))) {
+    while (ADCSRA & _BV(ADSC));
+    return;
+  }
+
+  /* clear stale flag (polled conversions never clear it) and let
+   * adc interrupt wake us up */
+  ADCSRA |= _BV(ADIF) | _BV(ADIE);
+  sleep_enable();
+  for (;;) {
+    cli();
+    if (!(ADCSRA & _BV(ADSC))) break;
+    set_sleep_mode(io_clock_needed() ? SLEEP_MODE_IDLE : SLEEP_MODE_ADC);
+    sei();
+    sleep_cpu();
+  }
+  sei();
+  sleep_disable();
+  ADCSRA &= ~_BV(ADIE);
+}
+
+
+static void sleep_convert(adc_channel ch) {
+  adc_prepare(ch);
+  /* discarded conversion, if any */
+  sleep_while_converting();
+  ADCSRA |= _BV(ADSC);
+  sleep_while_converting();
+}
+
+
+uint8_t adc_prep_sleep_get(adc_channel ch)
+{
+  sleep_convert(ch);
+  return adc_get();
+}
+
+
+uint16_t adc_prep_sleep_get16(adc_channel ch)
+{
+  sleep_convert(ch);
+  return adc_get16();
+}
+
+
+
+
+/*********************************************************
+ * Scan mode
+ *********************************************************/
+static struct {
+  adc_channel ch[ADC_SCAN_MAX];
+  volatile uint16_t value[ADC_SCAN_MAX];
+  volatile uint8_t seq[ADC_SCAN_MAX];
+  volatile uint8_t n;       /* channels scanned, 0 if not scanning */
+  uint8_t cur;              /* channel being converted */
+  bool discard;             /* current conversion to be discarded */
+} scan;
+
+
+/* starts conversion of the current scan channel */
+static void scan_convert(void) {
+  const adc_channel ch = scan.ch[scan.cur];
+
+  /* first conversion after a reference change is discarded */
+  scan.discard = M_RE(ch) != M_RE(last_channel_used);
+  ADMUX = admux(ch);
+  last_channel_used = ch;
+  ADCSRA |= _BV(ADSC);
+}
+
+
+/* a scan conversion ended (called from ADC_vect) */
+static void scan_next(void) {
+  if (!scan.discard) {
+    const uint8_t k = scan.cur;
+
+    scan.value[k] = M_RS(scan.ch[k]) ? ADC : ADCH;
+    scan.seq[k]++;
+    if (++scan.cur == scan.n) scan.cur = 0;
+  }
+  scan_convert();
+}
+
+
+void adc_scan_start(const adc_channel chs[], uint8_t n) {
+  if (n > ADC_SCAN_MAX) n = ADC_SCAN_MAX;
+  if (n == 0) return;
 
   /* avoid overreads */
   while (ADCSRA & _BV(ADSC));
 
-  /* start conversions */
+  for (uint8_t i = 0; i < n; i++) {
+    scan.ch[i] = chs[i];
+    scan.value[i] = 0;
+    scan.seq[i] = 0;
+  }
+  scan.n = n;
+  scan.cur = 0;
+  /* single conversions, each one started by the interrupt */
+  ADCSRA |= _BV(ADIE);
+  scan_convert();
+}
+
+
+void adc_scan_stop(void) {
+  ADCSRA &= ~_BV(ADIE);
+  scan.n = 0;
+  /* let last conversion end */
+  while (ADCSRA & _BV(ADSC));
+  os_resume();
+}
+
+
+uint16_t adc_scan_get(uint8_t i, uint8_t *seq) {
+  uint8_t s;
+  uint16_t v;
+
+  /* retry if a new value arrived while reading */
+  do {
+    s = scan.seq[i];
+    v = scan.value[i];
+  } while (s != scan.seq[i]);
+  if (seq) *seq = s;
+  return v;
+}
+
+
+uint8_t adc_scan_seq(uint8_t i) {
+  return scan.seq[i];
+}
+
+
+
+/*********************************************************
+ * Vcc calibration
+ *********************************************************/
+
+/* bandgap against Vcc, oversampled to 12 bits: several samples are
+ * averaged (the first ones after switching to the bandgap are
+ * discarded, see os_convert()) */
+#define CAL_CHANNEL C_ADC(ADC_CHANNEL_11V | ADC_10BIT, Vcc)
+#define CAL_K 2
+
+static bool os_starved(void);
+
+/* calibration measure context */
+static adc_os_t cal = {.done = true};
+/* last calibrated Vcc */
+static volatile uint16_t vcc_mv = ADC_VCC_NOMINAL_MV;
+
+
+/* computes Vcc from ended measure `os` (called from ADC_vect) */
+static void cal_fold(const adc_os_t *const os) {
+  const uint16_t bg = adc_os_get(os);
+
+  /* bg = 1.1V / Vcc * 2^(10+k) */
+  if (bg)
+    vcc_mv = ((uint32_t)ADC_BANDGAP_MV << (10 + CAL_K)) / bg;
+}
+
+
+bool adc_adjust_start(void) {
+  /* Vcc reference would be shorted to Aref pin */
+  if (incompatible_refs.n_aref)
+    alert_fatal(ALRT_INCOMPATIBLE_ADC_REF);
+  /* it would never be done */
+  if (os_starved()) return false;
+  /* ignored if already running */
+  (void)adc_os_start(&cal, CAL_CHANNEL, CAL_K);
+  return true;
+}
+
+
+bool adc_adjusting(void) {
+  return adc_os_running(&cal);
+}
+
+
+uint16_t adc_adjust(void) {
+  if (!adc_adjust_start()) return 0;
+  while (adc_os_running(&cal));
+  return adc_vcc();
+}
+
+
+uint16_t adc_vcc(void) {
+  uint16_t v;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    v = vcc_mv;
+  }
+  return v;
+}
+
+
+uint16_t adc_to_mv(uint8_t v) {
+  return ((uint32_t)v * adc_vcc()) >> 8;
+}
+
+
+uint16_t adc_to_mv16(uint16_t v) {
+  return ((uint32_t)v * adc_vcc()) >> 10;
+}
+
+
+
+/*********************************************************
+ * Oversampling read
+ *********************************************************/
+
+/* pending conversions, the head one is being sampled */
+static adc_os_t *volatile os_head, *os_tail;
+/* samples to be discarded before the next one is accounted */
+static uint8_t os_discard;
+
+/* conversions (26us) discarded after selecting the bandgap */
+#define BG_SETTLE 4
+
+/* context of compatibility oversampling functions */
+static adc_os_t legacy = {.done = true};
+
+
+static void os_drain(void) {
+  /* with interrupts disabled the queue can not move */
+  if (SREG & _BV(SREG_I))
+    while (os_head);
+}
+
+
+/* starts a sample conversion of the head context */
+static void os_convert(void) {
+  const adc_channel ch = os_head->ch;
+
+  if (M_CH(ch) == ADC_CHANNEL_11V &&
+      M_CH(last_channel_used) != ADC_CHANNEL_11V)
+    /* the bandgap input settles in about 70us after being selected */
+    os_discard = BG_SETTLE;
+  else if (M_RE(ch) != M_RE(last_channel_used))
+    /* first conversion after a reference change is discarded */
+    os_discard = 1;
+  ADMUX = admux(ch);
+  last_channel_used = ch;
   ADCSRA |= _BV(ADSC);
 }
 
 
+static void os_resume(void) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (os_head) {
+      /* drop the result of the last scan or stream conversion */
+      ADCSRA |= _BV(ADIF) | _BV(ADIE);
+      os_convert();
+    }
+  }
+}
+
+
+/* a sample conversion ended (called from ADC_vect) */
+static void os_next(void) {
+  adc_os_t *const os = os_head;
+
+  if (os_discard) {
+    os_discard--;
+  } else {
+    os->sum += M_RS(os->ch) ? ADC : ADCH;
+    if (--os->left == 0) {
+      os_head = os->next;
+      if (os == &cal) cal_fold(os);
+      os->done = true;
+      if (!os_head) {
+	/* no more sampling */
+	ADCSRA &= ~_BV(ADIE);
+	return;
+      }
+    }
+  }
+  os_convert();
+}
+
+
+bool adc_os_start(adc_os_t *const os, adc_channel ch, uint8_t k) {
+  if (k > ADC_OS_MAX_K) k = ADC_OS_MAX_K;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    /* ADMUX and ADSC belong to the scan or stream */
+    if (os_starved()) return false;
+    /* a queued context is left alone: relinking it makes a loop */
+    for (const adc_os_t *p = os_head; p; p = p->next)
+      if (p == os) return false;
+
+    os->ch = ch;
+    os->k = k;
+    os->left = UINT16_C(1) << (2*k);
+    os->sum = 0;
+    os->done = false;
+    os->next = NULL;
+    if (os_head) {
+      os_tail->next = os;
+      os_tail = os;
+    } else {
+      os_head = os_tail = os;
+      /* avoid overreads */
+      while (ADCSRA & _BV(ADSC));
+      /* single conversions, each one started by the interrupt */
+      ADCSRA |= _BV(ADIE);
+      os_convert();
+    }
+  }
+  return true;
+}
+
+
+bool adc_os_running(const adc_os_t *const os) {
+  return !os->done;
+}
+
+
+uint16_t adc_os_get(const adc_os_t *const os) {
+  /* decimate rounding half up */
+  if (os->k == 0) return os->sum;
+  return (os->sum + (UINT32_C(1) << (os->k - 1))) >> os->k;
+}
+
+
+void adc_start_oversample(void) {
+  adc_os_start(&legacy, last_channel_used, 1);
+}
+
+
 bool adc_oversampling(void) {
-  return num_samples != N_SAMPLES;
+  return adc_os_running(&legacy);
 }
 
 
 uint8_t adc_get_oversample(void) {
-  /* check fractional part: if most significant bit of fractional part
-     is set, then add 1 to round-up */
-  if (sample_sum & (N_SAMPLES >> 1))
-    return sample_sum / N_SAMPLES + 1;
-  else
-    return sample_sum / N_SAMPLES;
+  /* mean of the 4 samples, rounded */
+  const uint16_t mean = (legacy.sum + 2) >> 2;
+
+  return M_RS(legacy.ch) ? mean >> 2 : mean;
 }
 
 
-ISR(ADC_vect) {
-  sample_sum += ADCH;
-  if (++num_samples == N_SAMPLES) {
-    /* no more sampling */
-    /* disable trigger mode and disable interrupts */
-    ADCSRA &= ~(_BV(ADATE) | _BV(ADIE));
+/*********************************************************
+ * Fixed rate acquisition
+ *********************************************************/
+
+#define ADTS_MASK (_BV(ADTS2) | _BV(ADTS1) | _BV(ADTS0))
+
+static struct {
+  volatile uint16_t ring[ADC_RING_L];   /* written by the ISR */
+  volatile uint8_t head;    /* next cell to be written (by the ISR) */
+  volatile uint8_t tail;    /* next cell to be read */
+  volatile uint8_t overruns;
+  volatile bool on;
+  adc_channel ch;
+} stream;
+
+
+/* a triggered conversion ended (called from ADC_vect) */
+static void stream_next(void) {
+  const uint8_t next = (stream.head + 1) & (ADC_RING_L - 1);
+
+  /* the trigger is the rising edge of OCF1B: clear it to rearm */
+  TIFR1 = _BV(OCF1B);
+  if (next == stream.tail) {
+    if (stream.overruns != UINT8_MAX) stream.overruns++;
+  } else {
+    stream.ring[stream.head] = M_RS(stream.ch) ? ADC : ADCH;
+    stream.head = next;
   }
 }
 
 
+void adc_stream_start(adc_channel ch, uint16_t rate) {
+  uint8_t cs;
+
+  adc_prepare(ch);
+  /* wait a discarded conversion, if any */
+  while (ADCSRA & _BV(ADSC));
+
+  stream.ch = ch;
+  stream.head = stream.tail = stream.overruns = 0;
+
+  /* TIMER1 in CTC mode (TOP = OCR1A), no outputs, no interrupts */
+  TCCR1A = 0;
+  TCCR1B = _BV(WGM12);
+  TIMSK1 = 0;
+  if (rate == 0) rate = 1;
+  if (rate > ADC_STREAM_MAX_RATE) rate = ADC_STREAM_MAX_RATE;
+  if (rate >= 31) {
+    OCR1A = (F_CPU / 8) / rate - 1;
+    cs = _BV(CS11);                 /* clk/8 */
+  } else {
+    OCR1A = (F_CPU / 256) / rate - 1;
+    cs = _BV(CS12);                 /* clk/256 */
+  }
+  OCR1B = OCR1A;                    /* match B once per period */
+  TCNT1 = 0;
+  TIFR1 = _BV(OCF1B);
+
+  /* trigger source: TIMER1 compare match B */
+  ADCSRB = (ADCSRB & ~ADTS_MASK) | _BV(ADTS2) | _BV(ADTS0);
+  stream.on = true;
+  ADCSRA |= _BV(ADATE) | _BV(ADIE);
+  /* start timer */
+  TCCR1B |= cs;
+}
+
+
+void adc_stream_stop(void) {
+  TCCR1B = 0;
+  ADCSRA &= ~(_BV(ADATE) | _BV(ADIE));
+  ADCSRB &= ~ADTS_MASK;
+  stream.on = false;
+  /* let last conversion end */
+  while (ADCSRA & _BV(ADSC));
+  os_resume();
+}
+
+
+uint8_t adc_stream_available(void) {
+  return (stream.head - stream.tail) & (ADC_RING_L - 1);
+}
+
+
+uint16_t adc_stream_get(void) {
+  const uint16_t v = stream.ring[stream.tail];
+
+  stream.tail = (stream.tail + 1) & (ADC_RING_L - 1);
+  return v;
+}
+
+
+uint8_t adc_stream_overruns(void) {
+  return stream.overruns;
+}
+
+
+
+/* scan and stream take every conversion: oversampling waits */
+static bool os_starved(void) {
+  return stream.on || scan.n;
+}
+
+
+ISR(ADC_vect) {
+  if (stream.on)
+    stream_next();
+  else if (scan.n)
+    scan_next();
+  else if (os_head)
+    os_next();
+}
+
+
 
 
 void adc_setup(void) {
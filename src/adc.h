@@ -15,6 +15,11 @@
  */
 #define ADC_MAX 0xff
 
+/** 
+ * Max value returned by adc module 10 bits conversion (see ::ADC_10BIT)
+ */
+#define ADC_MAX10 0x3ff
+
 /** 
  * @brief Traslates adc value to a given range
  * 
@@ -40,6 +45,17 @@
 ///@}
 
 
+/**
+ * @brief 10 bits resolution flag.
+ *
+ * OR'ed to the port number given to adc_bind(), the channel is
+ * converted with 10 bits of resolution. Its values are read with
+ * adc_get16() in the range [0..::ADC_MAX10]. Otherwise channels are
+ * converted with 8 bits and read with adc_get().
+ */
+#define ADC_10BIT 020
+
+
 /** 
  * @brief A reference voltage source.
  * 
@@ -75,7 +91,7 @@ typedef uint8_t adc_channel;
  * @throws ALRT_INCOMPATIBLE_ADC_REF If any incompatibility arises
  * between reference sources of the currently bound adc channels.
  *
- * @param ch: Analog port number.
+ * @param ch: Analog port number, optionally OR'ed with ::ADC_10BIT.
  * @param ref: Reference voltage source for this channel.
  *
  * @return An bound ::adc_channel
@@ -97,6 +113,10 @@ void adc_unbind(adc_channel *const ch);
  *  You can only query the last prepared channel. There is no 
  *  chance to read several channels concurrently.
  *
+ *  Pending oversampled conversions (calibration included) are waited
+ *  for first: they use the adc meanwhile. None must be requested
+ *  until the result of the prepared channel is read.
+ *
  *  @param ch The bound logical channel to be prepared.
  */
 void adc_prepare(adc_channel ch);
@@ -104,6 +124,8 @@ void adc_prepare(adc_channel ch);
 
 /**
  * @brief Starts a sampling on the last prepared channel 
+ *
+ * Waits for pending oversampled conversions, as adc_prepare().
  */
 void adc_start_conversion(void);
 
@@ -123,6 +145,17 @@ bool adc_converting(void);
  */
 uint8_t adc_get(void);
 
+/**
+ * @brief Gets the value of the last started conversion of a 10 bits
+ * channel.
+ * 
+ * Can only be applyed after conversion ended, on a channel bound
+ * with ::ADC_10BIT.
+ *
+ * @returns A value in range [0..::ADC_MAX10]
+ */
+uint16_t adc_get16(void);
+
 
 
 /**
@@ -148,24 +181,318 @@ void adc_prepare_start(adc_channel ch);
  */
 uint8_t adc_prep_start_get(adc_channel ch);
 
+/**
+ * @brief Prepares, starts and reads a 10 bits channel
+ *
+ * As adc_prep_start_get() for channels bound with ::ADC_10BIT.
+ *
+ * @param ch: The logical channel to be sampled
+ * @returns A sampled value in range [0..::ADC_MAX10]
+ */
+uint16_t adc_prep_start_get16(adc_channel ch);
+
+/**
+ * @brief Prepares, converts and reads a channel sleeping the CPU
+ *
+ * As adc_prep_start_get(), but instead of spinning the CPU sleeps in
+ * ADC noise reduction mode while converting. Digital noise is lower
+ * and the CPU is not active during conversion.
+ *
+ * Other interrupts (ticker, serial...) wake the CPU up earlier: they
+ * are served and the CPU sleeps again until the conversion ends.
+ * Noise reduction mode halts the I/O clock, thus it is only used
+ * while the usart receiver is disabled, no frame is being
+ * transmitted, the ticker is stopped and no i2c request is being
+ * moved. Otherwise the CPU sleeps in idle mode, so no byte, tick or
+ * i2c transfer is stalled. Timers 0 and 1 (switch,
+ * timer) still pause during a noise reduction conversion: they drift
+ * about 26us per conversion. Until the first frame is sent after a
+ * reset the transmitter state can not be told and idle mode is used.
+ *
+ * If interrupts are disabled it spins as adc_prep_start_get().
+ * Must not be used while scan, oversampling or fixed rate
+ * acquisition are running.
+ *
+ * @param ch: The logical channel to be sampled
+ * @returns A sampled value in range [0..::ADC_MAX]
+ */
+uint8_t adc_prep_sleep_get(adc_channel ch);
 
+/**
+ * @brief Prepares, converts and reads a 10 bits channel sleeping
+ *
+ * As adc_prep_sleep_get() for channels bound with ::ADC_10BIT.
+ *
+ * @param ch: The logical channel to be sampled
+ * @returns A sampled value in range [0..::ADC_MAX10]
+ */
+uint16_t adc_prep_sleep_get16(adc_channel ch);
 
 
 
-/*
- * Adjust channel range.
- * When Vcc external reference is used, this function can be used to
- * calibrate against the internal 1.1V reference. The function returns
- * the real voltage corresponding to Vcc. 
+
+
+/**
+ * \name Vcc calibration
+ *
+ * The supply voltage, used as reference by ::Vcc channels, is not
+ * accurate (USB or battery supplied boards differ). It is calibrated
+ * measuring the internal 1.1V bandgap against Vcc. Then conversions
+ * of ::Vcc channels can be translated to millivolts.
+ *
+ * Calibration uses an oversampled conversion (see adc_os_start()):
+ * the same restrictions apply. The first conversions after selecting
+ * the bandgap are discarded while it settles. It can not be done if a
+ * channel is bound to ::Aref.
+ */
+///@{
+
+/** Internal bandgap voltage (mV). Nominal; can be trimmed per device */
+#ifndef ADC_BANDGAP_MV
+#define ADC_BANDGAP_MV 1100
+#endif
+
+/** Vcc (mV) assumed until calibrated */
+#define ADC_VCC_NOMINAL_MV 5000
+
+/**
+ * @brief Calibrates Vcc against the internal bandgap and waits.
+ *
+ * Takes about 0.5 ms. It can not be done while a scan or a fixed rate
+ * acquisition is running: they take every conversion.
+ *
+ * @throws ALRT_INCOMPATIBLE_ADC_REF If a channel is bound to ::Aref.
+ * @returns The calibrated Vcc in millivolts, or 0 if a scan or a fixed
+ *          rate acquisition is running.
+ */
+uint16_t adc_adjust(void);
+
+/**
+ * @brief Starts a Vcc calibration in background.
+ *
+ * The calibrated value is updated by the adc interrupt when it ends.
+ * Calling it periodically (e.g. every second from a thread) follows
+ * supply changes at almost no cost. Polled and sleeping conversions
+ * wait for it to end (see adc_prepare()). Ignored if a calibration is
+ * already running.
+ *
+ * @throws ALRT_INCOMPATIBLE_ADC_REF If a channel is bound to ::Aref.
+ * @returns false, and nothing is started, if a scan or a fixed rate
+ *          acquisition is running (see adc_adjust()).
+ */
+bool adc_adjust_start(void);
+
+/**
+ * @brief True iff a calibration is running.
+ */
+bool adc_adjusting(void);
+
+/**
+ * @brief Last calibrated Vcc in millivolts.
+ *
+ * ::ADC_VCC_NOMINAL_MV if never calibrated.
+ */
+uint16_t adc_vcc(void);
+
+/**
+ * @brief Translates a value of a ::Vcc channel to millivolts.
+ *
+ * @param v: An 8 bits value.
+ */
+uint16_t adc_to_mv(uint8_t v);
+
+/**
+ * @brief Translates a value of a 10 bits ::Vcc channel to millivolts.
+ *
+ * @param v: A 10 bits value (see ::ADC_10BIT).
+ */
+uint16_t adc_to_mv16(uint16_t v);
+
+///@}
+
+
+/**
+ * \name Scan mode
+ *
+ * In scan mode the adc converts a list of channels round robin, from
+ * its interrupt, with no CPU waiting. The last value of every channel
+ * is kept together with a sequence counter that increases on each new
+ * value. Values can be read anytime without locking. While scanning,
+ * no other conversion can be done.
+ */
+///@{
+
+/** Max number of channels scanned */
+#define ADC_SCAN_MAX 8
+
+/**
+ * @brief Starts scanning channels.
+ *
+ * Channels are converted in order, over and over. 8 and 10 bits
+ * channels can be mixed. Mixing reference sources costs an extra
+ * (discarded) conversion on each change.
+ *
+ * @param chs: Array of `n` bound channels. It is copied.
+ * @param n:   Number of channels (at most ::ADC_SCAN_MAX).
+ */
+void adc_scan_start(const adc_channel chs[], uint8_t n);
+
+/**
+ * @brief Stops scanning. Last values can still be read. Pending
+ * oversampled conversions go on.
+ */
+void adc_scan_stop(void);
+
+/**
+ * @brief Gets the last value of the `i`-th scanned channel.
+ *
+ * @param i:   Index of the channel in the scanned list.
+ * @param seq: If not NULL, where to store the sequence counter of
+ *             the value returned.
+ * @returns Last value, in range [0..::ADC_MAX] or [0..::ADC_MAX10]
+ *          depending on the channel resolution.
+ */
+uint16_t adc_scan_get(uint8_t i, uint8_t *seq);
+
+/**
+ * @brief Gets the sequence counter of the `i`-th scanned channel.
+ * It changes when a new value is available.
+ */
+uint8_t adc_scan_seq(uint8_t i);
+
+///@}
+
+
+/**
+ * \name Oversampling
+ *
+ * An oversampled conversion of a channel sums 4^k samples and
+ * decimates the sum to get k extra bits of resolution: 8+k bits for 8
+ * bits channels and 10+k bits for 10 bits channels. It needs some
+ * noise in the signal (at least 1 LSB) to be effective. Samples are
+ * taken from the adc interrupt, each one lasting about 26 us.
+ *
+ * Every oversampled conversion has its own context, owned by the
+ * caller, thus several ones can be requested at once: they are done
+ * in request order. Channels are prepared by the module. No other
+ * conversion must be done meanwhile, and none can be requested while
+ * scanning or acquiring at a fixed rate.
+ */
+///@{
+
+/** Max extra bits of an oversampled conversion */
+#define ADC_OS_MAX_K 6
+
+/** Oversampled conversion context */
+typedef struct adc_os {
+  adc_channel ch;           /**< channel sampled */
+  uint8_t k;                /**< extra bits */
+  uint16_t left;            /**< samples left */
+  uint32_t sum;             /**< sum of samples */
+  volatile bool done;       /**< conversion ended */
+  struct adc_os *next;      /**< next pending conversion */
+} adc_os_t;
+
+/**
+ * @brief Requests an oversampled conversion.
+ *
+ * A context whose conversion is still pending or running is not
+ * requested again: it goes on with its current conversion. Nothing is
+ * requested while scanning or acquiring at a fixed rate: they own the
+ * adc.
+ *
+ * @param os: Context of the conversion. Must live until it ends.
+ * @param ch: Bound channel to be sampled.
+ * @param k:  Extra bits (0..::ADC_OS_MAX_K): 4^k samples are taken.
+ * @returns false iff `os` was already requested and not ended, or
+ *          a scan or a fixed rate acquisition is running.
+ */
+bool adc_os_start(adc_os_t *const os, adc_channel ch, uint8_t k);
+
+/**
+ * @brief True iff the oversampled conversion `os` did not end yet.
+ */
+bool adc_os_running(const adc_os_t *const os);
+
+/**
+ * @brief Gets the decimated value of an ended oversampled conversion.
+ *
+ * @returns A value of 8+k or 10+k bits (see ::ADC_10BIT), rounded.
  */
-// float adc_adjust(void); not implemented yet
+uint16_t adc_os_get(const adc_os_t *const os);
+
+///@}
+
+
+/**
+ * \name Fixed rate acquisition
+ *
+ * Conversions of a channel are triggered by TIMER1 compare match B
+ * at a fixed rate, thus sampling times do not depend on software.
+ * Samples are stored by the adc interrupt into a ring buffer, where
+ * they are read from. If the ring buffer is full, new samples are
+ * lost and counted as overruns.
+ *
+ * This mode uses TIMER1: it cannot be used together with the timer
+ * module (or modules using it, as i2cp). No other conversion must be
+ * done meanwhile.
+ */
+///@{
+
+/** Ring buffer length (a power of 2). Holds ADC_RING_L-1 samples */
+#define ADC_RING_L 32
+
+/**
+ * Highest sample rate. An auto triggered conversion takes 13.5 adc
+ * clocks (F_CPU/32) plus up to one clock to synchronize the trigger;
+ * triggers arriving while converting are ignored.
+ */
+#define ADC_STREAM_MAX_RATE ((F_CPU / 32) / 14)
+
+/**
+ * @brief Starts fixed rate acquisition of channel `ch`.
+ *
+ * @param ch:   Bound channel to be sampled.
+ * @param rate: Samples per second (1..ADC_STREAM_MAX_RATE, 35714 at
+ *              16 MHz). Higher rates are clamped. Rates below 31 Hz
+ *              are rounded to a 16 us grid; others to a 0.5 us grid.
+ */
+void adc_stream_start(adc_channel ch, uint16_t rate);
+
+/**
+ * @brief Stops fixed rate acquisition. Buffered samples can still
+ * be read. Pending oversampled conversions go on.
+ */
+void adc_stream_stop(void);
+
+/**
+ * @brief Number of samples in the ring buffer.
+ */
+uint8_t adc_stream_available(void);
+
+/**
+ * @brief Gets and removes the oldest sample of the ring buffer.
+ *
+ * @pre adc_stream_available() > 0
+ * @returns A value in range [0..::ADC_MAX] or [0..::ADC_MAX10]
+ *          depending on the channel resolution.
+ */
+uint16_t adc_stream_get(void);
+
+/**
+ * @brief Number of samples lost because the ring buffer was full,
+ * since acquisition started. Saturates at 255.
+ */
+uint8_t adc_stream_overruns(void);
+
+///@}
 
 
 /*
- * Oversampling conversion.
+ * Oversampling conversion of the last prepared channel.
  * Four continuous measures of the same channel are made and the 
  * mean returned. Measuring span is of 13.5*4=54 cycles, approx.
- * 108 us.
+ * 108 us. Kept for compatibility: see adc_os_start().
  */
 void adc_start_oversample(void);
 bool adc_oversampling(void);
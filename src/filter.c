@@ -0,0 +1,150 @@
+#include <stdint.h>
+#include "filter.h"
+
+#if FILTER_BOX_LOG > 6
+#error "FILTER_BOX_LOG too big: boxcar sum overflows with 10 bits samples"
+#endif
+
+#if FILTER_MEDIAN_L != 3 && FILTER_MEDIAN_L != 5
+#error "FILTER_MEDIAN_L must be 3 or 5"
+#endif
+
+
+
+/**************************************************
+ * Boxcar
+ **************************************************/
+
+void filter_box_init(filter_box_t *const f, uint16_t x0) {
+  for (uint8_t i = 0; i < FILTER_BOX_L; i++) f->x[i] = x0;
+  f->sum = x0 << FILTER_BOX_LOG;
+  f->i = 0;
+}
+
+
+uint16_t filter_box(filter_box_t *const f, uint16_t x) {
+  /* replace oldest sample in the running sum */
+  f->sum += x - f->x[f->i];
+  f->x[f->i] = x;
+  f->i = (f->i + 1) & (FILTER_BOX_L - 1);
+  return (f->sum + (FILTER_BOX_L >> 1)) >> FILTER_BOX_LOG;
+}
+
+
+
+/**************************************************
+ * Single pole IIR
+ **************************************************/
+
+void filter_iir_init(filter_iir_t *const f, uint8_t k, uint16_t y0) {
+  f->k = (k > FILTER_IIR_MAX_K) ? FILTER_IIR_MAX_K : k;
+  f->s = y0 << f->k;
+}
+
+
+uint16_t filter_iir(filter_iir_t *const f, uint16_t x) {
+  /* s/2^k += x - s/2^k, all scaled by 2^k */
+  f->s += x - (f->s >> f->k);
+  return (f->s + ((1 << f->k) >> 1)) >> f->k;
+}
+
+
+
+/**************************************************
+ * Median
+ **************************************************/
+
+/* compare and swap: leaves a <= b */
+#define CS(a, b) \
+  do { if ((a) > (b)) { const uint16_t t = (a); (a) = (b); (b) = t; } } while (0)
+
+
+void filter_median_init(filter_median_t *const f, uint16_t x0) {
+  for (uint8_t i = 0; i < FILTER_MEDIAN_L; i++) f->x[i] = x0;
+  f->i = 0;
+}
+
+
+uint16_t filter_median(filter_median_t *const f, uint16_t x) {
+  uint16_t p[FILTER_MEDIAN_L];
+
+  f->x[f->i] = x;
+  if (++f->i == FILTER_MEDIAN_L) f->i = 0;
+
+  /* sorting networks reduced to the median: no branches on data
+   * length, constant time */
+  for (uint8_t i = 0; i < FILTER_MEDIAN_L; i++) p[i] = f->x[i];
+#if FILTER_MEDIAN_L == 3
+  CS(p[0], p[1]); CS(p[1], p[2]); CS(p[0], p[1]);
+  return p[1];
+#else
+  CS(p[0], p[1]); CS(p[3], p[4]); CS(p[0], p[3]);
+  CS(p[1], p[4]); CS(p[1], p[2]); CS(p[2], p[3]);
+  CS(p[1], p[2]);
+  return p[2];
+#endif
+}
+
+
+
+/**************************************************
+ * Biquad
+ **************************************************/
+
+static int16_t saturate(int32_t v) {
+  if (v > INT16_MAX) return INT16_MAX;
+  if (v < INT16_MIN) return INT16_MIN;
+  return v;
+}
+
+
+void filter_biquad_init(filter_biquad_t *const f,
+			const filter_biquad_coefs_t *c, int16_t x0) {
+  const int32_t num = (int32_t)c->b0 + c->b1 + c->b2;
+  const int32_t den = (int32_t)FILTER_Q14_ONE + c->a1 + c->a2;
+
+  f->c = c;
+  f->x1 = f->x2 = x0;
+  f->y1 = f->y2 = x0;
+  f->e1 = f->e2 = 0;
+  if (den) {
+    /* steady state output: x0 times DC gain, rounded, and its
+     * fraction in Q14 */
+    const int32_t q = (int32_t)x0 * num;
+    int32_t y = (q + (q < 0 ? -den/2 : den/2)) / den;
+    const int32_t e = ((q - y * den) << 14) / den;
+
+    if (y != saturate(y)) {
+      y = saturate(y);
+    } else {
+      f->e1 = f->e2 = e;
+    }
+    f->y1 = f->y2 = y;
+  }
+}
+
+
+int16_t filter_biquad(filter_biquad_t *const f, int16_t x) {
+  const filter_biquad_coefs_t *const c = f->c;
+  int32_t acc;
+  int16_t y;
+
+  acc  = (int32_t)c->b0 * x + (int32_t)c->b1 * f->x1 + (int32_t)c->b2 * f->x2;
+  acc -= (int32_t)c->a1 * f->y1 + (int32_t)c->a2 * f->y2;
+  /* fractions of the last outputs, fed back: as if outputs were kept
+   * in Q14 */
+  acc -= ((int32_t)c->a1 * f->e1 + (int32_t)c->a2 * f->e2) >> 14;
+  /* back to Q0, rounded */
+  y = saturate((acc + (FILTER_Q14_ONE >> 1)) >> 14);
+
+  f->x2 = f->x1;
+  f->x1 = x;
+  f->y2 = f->y1;
+  f->y1 = y;
+  f->e2 = f->e1;
+  /* the fraction is lost if the output saturates */
+  acc -= (int32_t)y << 14;
+  f->e1 = (acc >= -(FILTER_Q14_ONE >> 1) && acc < (FILTER_Q14_ONE >> 1))
+    ? acc : 0;
+  return y;
+}
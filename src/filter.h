@@ -0,0 +1,121 @@
+#ifndef _FILTER_H_
+#define _FILTER_H_
+
+/*
+ * Streaming filters for adc samples
+ *
+ * Characteristics:
+ * (1) Every filter is a state object supplied by the caller. Nothing
+ *     is allocated; state sizes are fixed by the macros below.
+ * (2) Filters take a sample and return the filtered value. Integer
+ *     arithmetic only, with constant time per sample: they can be run
+ *     inside ADC_vect or in a thread, as samples arrive.
+ * (3) A filter state must be used by a single thread (or ISR).
+ */
+
+#include <stdint.h>
+
+
+/*
+ * Boxcar (moving average) of the last FILTER_BOX_L samples, kept as a
+ * running sum. FILTER_BOX_L is a power of 2 so the mean is a shift.
+ * The sum is 16 bits: for 10 bits samples FILTER_BOX_LOG <= 6.
+ */
+#define FILTER_BOX_LOG 3
+#define FILTER_BOX_L (1 << FILTER_BOX_LOG)
+
+typedef struct {
+  uint16_t x[FILTER_BOX_L];     // last samples
+  uint16_t sum;                 // sum of `x`
+  uint8_t i;                    // oldest sample
+} filter_box_t;
+
+/* Initializes the boxcar as if it had always been fed with `x0` */
+void filter_box_init(filter_box_t *const f, uint16_t x0);
+
+/* Feeds sample `x`. Returns the mean of the last FILTER_BOX_L samples */
+uint16_t filter_box(filter_box_t *const f, uint16_t x);
+
+
+/*
+ * Single pole IIR low pass: y += (x - y) / 2^k. The state keeps k
+ * fractional bits, so small steps are not lost. Time constant is
+ * about 2^k samples. The state is 16 bits: for 10 bits samples
+ * k <= FILTER_IIR_MAX_K.
+ */
+#define FILTER_IIR_MAX_K 6
+
+typedef struct {
+  uint16_t s;                   // output scaled by 2^k
+  uint8_t k;
+} filter_iir_t;
+
+/* Initializes the filter with shift `k` and output `y0` */
+void filter_iir_init(filter_iir_t *const f, uint8_t k, uint16_t y0);
+
+/* Feeds sample `x`. Returns the filtered value, rounded */
+uint16_t filter_iir(filter_iir_t *const f, uint16_t x);
+
+
+/*
+ * Median of the last FILTER_MEDIAN_L samples (3 or 5). Rejects
+ * spikes shorter than FILTER_MEDIAN_L/2 + 1 samples and keeps steps.
+ */
+#define FILTER_MEDIAN_L 3
+
+typedef struct {
+  uint16_t x[FILTER_MEDIAN_L];  // last samples
+  uint8_t i;                    // oldest sample
+} filter_median_t;
+
+/* Initializes the filter as if it had always been fed with `x0` */
+void filter_median_init(filter_median_t *const f, uint16_t x0);
+
+/* Feeds sample `x`. Returns the median of the last samples */
+uint16_t filter_median(filter_median_t *const f, uint16_t x);
+
+
+/*
+ * Biquad (second order IIR section), direct form I:
+ *
+ *   y[n] = b0 x[n] + b1 x[n-1] + b2 x[n-2] - a1 y[n-1] - a2 y[n-2]
+ *
+ * Coefficients are Q14 fixed point (FILTER_Q14_ONE is 1.0), since
+ * a1 of low pass sections is near -2. Products are accumulated in 32
+ * bits and the output saturates to 16 bits. Samples are signed: 10
+ * bits adc values can be fed directly.
+ *
+ * The Q14 fraction of the last outputs is kept and fed back (error
+ * feedback), so the recursion behaves as if outputs had 14 fractional
+ * bits: no dead band around the steady state. For unity DC gain the
+ * rounded coefficients must keep b0 + b1 + b2 == 1 + a1 + a2 (in
+ * Q14): adjust a b coefficient by one if rounding breaks it.
+ */
+#define FILTER_Q14_ONE (1 << 14)
+
+/* float coefficient to Q14, for constant initializers */
+#define FILTER_Q14(c) ((int16_t)((c) * FILTER_Q14_ONE + ((c) < 0 ? -0.5 : 0.5)))
+
+typedef struct {
+  int16_t b0, b1, b2, a1, a2;
+} filter_biquad_coefs_t;
+
+typedef struct {
+  const filter_biquad_coefs_t *c;
+  int16_t x1, x2;               // last inputs
+  int16_t y1, y2;               // last outputs
+  int16_t e1, e2;               // their Q14 fractions
+} filter_biquad_t;
+
+/*
+ * Initializes the section with coefficients `c` (not copied) in the
+ * steady state for a constant input `x0`.
+ */
+void filter_biquad_init(filter_biquad_t *const f,
+			const filter_biquad_coefs_t *c, int16_t x0);
+
+/* Feeds sample `x`. Returns the filtered value */
+int16_t filter_biquad(filter_biquad_t *const f, int16_t x);
+
+
+#endif
@@ -1,17 +1,32 @@
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 #include <util/twi.h>
 #include <util/atomic.h>
 #include "i2cr.h"
 #include "i2cq.h"
 #include "i2c.h"
+#include "ticker.h"
 
 
-#define TW_GO_OPERATIVE 0xff  // special automata event
 #define TWI_FREQ 100000UL     // i2c bus frequency
 
+#define PRIO_OWNER  0         // priority class of bus owner requests
+#define PRIO_URGENT 1         // priority class of urgent requests
+#define PRIO_NORMAL 2         // priority class of other requests
+
+#define NODE_MASK 0x7f        // node address without request flags
+
+/* statistics code is compiled out unless I2C_STATS is defined */
+#ifdef I2C_STATS
+#define STATS(x) do { x; } while (0)
+#else
+#define STATS(x) do { } while (0)
+#endif
+
 
 
 
@@ -88,6 +103,43 @@ static void throw_request_byte(bool is_last){
 }
 
 
+/**
+ * @brief CRC-8 (polynomial x^8+x^2+x+1) table used by SMBus PEC.
+ */
+static const uint8_t crc8_table[256] PROGMEM = {
+  0x00, 0x07, 0x0e, 0x09, 0x1c, 0x1b, 0x12, 0x15, 0x38, 0x3f, 0x36, 0x31,
+  0x24, 0x23, 0x2a, 0x2d, 0x70, 0x77, 0x7e, 0x79, 0x6c, 0x6b, 0x62, 0x65,
+  0x48, 0x4f, 0x46, 0x41, 0x54, 0x53, 0x5a, 0x5d, 0xe0, 0xe7, 0xee, 0xe9,
+  0xfc, 0xfb, 0xf2, 0xf5, 0xd8, 0xdf, 0xd6, 0xd1, 0xc4, 0xc3, 0xca, 0xcd,
+  0x90, 0x97, 0x9e, 0x99, 0x8c, 0x8b, 0x82, 0x85, 0xa8, 0xaf, 0xa6, 0xa1,
+  0xb4, 0xb3, 0xba, 0xbd, 0xc7, 0xc0, 0xc9, 0xce, 0xdb, 0xdc, 0xd5, 0xd2,
+  0xff, 0xf8, 0xf1, 0xf6, 0xe3, 0xe4, 0xed, 0xea, 0xb7, 0xb0, 0xb9, 0xbe,
+  0xab, 0xac, 0xa5, 0xa2, 0x8f, 0x88, 0x81, 0x86, 0x93, 0x94, 0x9d, 0x9a,
+  0x27, 0x20, 0x29, 0x2e, 0x3b, 0x3c, 0x35, 0x32, 0x1f, 0x18, 0x11, 0x16,
+  0x03, 0x04, 0x0d, 0x0a, 0x57, 0x50, 0x59, 0x5e, 0x4b, 0x4c, 0x45, 0x42,
+  0x6f, 0x68, 0x61, 0x66, 0x73, 0x74, 0x7d, 0x7a, 0x89, 0x8e, 0x87, 0x80,
+  0x95, 0x92, 0x9b, 0x9c, 0xb1, 0xb6, 0xbf, 0xb8, 0xad, 0xaa, 0xa3, 0xa4,
+  0xf9, 0xfe, 0xf7, 0xf0, 0xe5, 0xe2, 0xeb, 0xec, 0xc1, 0xc6, 0xcf, 0xc8,
+  0xdd, 0xda, 0xd3, 0xd4, 0x69, 0x6e, 0x67, 0x60, 0x75, 0x72, 0x7b, 0x7c,
+  0x51, 0x56, 0x5f, 0x58, 0x4d, 0x4a, 0x43, 0x44, 0x19, 0x1e, 0x17, 0x10,
+  0x05, 0x02, 0x0b, 0x0c, 0x21, 0x26, 0x2f, 0x28, 0x3d, 0x3a, 0x33, 0x34,
+  0x4e, 0x49, 0x40, 0x47, 0x52, 0x55, 0x5c, 0x5b, 0x76, 0x71, 0x78, 0x7f,
+  0x6a, 0x6d, 0x64, 0x63, 0x3e, 0x39, 0x30, 0x37, 0x22, 0x25, 0x2c, 0x2b,
+  0x06, 0x01, 0x08, 0x0f, 0x1a, 0x1d, 0x14, 0x13, 0xae, 0xa9, 0xa0, 0xa7,
+  0xb2, 0xb5, 0xbc, 0xbb, 0x96, 0x91, 0x98, 0x9f, 0x8a, 0x8d, 0x84, 0x83,
+  0xde, 0xd9, 0xd0, 0xd7, 0xc2, 0xc5, 0xcc, 0xcb, 0xe6, 0xe1, 0xe8, 0xef,
+  0xfa, 0xfd, 0xf4, 0xf3,
+};
+
+
+/**
+ * @brief Updates the PEC `crc` with byte `b`.
+ */
+static inline uint8_t crc8(uint8_t crc, uint8_t b) {
+  return pgm_read_byte(&crc8_table[crc ^ b]);
+}
+
+
 /**
  * @brief Get the recieved byte from I2C hw
  *
@@ -106,7 +158,8 @@ static uint8_t get_byte(void) {
 
 /* Automata current state */
 static volatile enum {
-  Idle, Starting, SeekingSlaveTx, TxData, SeekingSlaveRx, RxData
+  Idle, Starting, SeekingSlaveTx, TxData, SeekingSlaveRx, RxData,
+  Holding
 } ida_state;
 
 /* Requests queue */
@@ -115,31 +168,446 @@ static i2cq_t requests;
 /* request being processed by right now */
 static const i2cr_request_t *current_req;
 
+/*
+ * Current request normalised as a byte source (sends) or sink
+ * (receives). A vectored send is a source made of several chunks.
+ */
+static struct {
+  const uint8_t *src;           //!< Next byte to be sent
+  uint8_t *dst;                 //!< Where next byte received goes
+  uint16_t left;                //!< Bytes left in current chunk
+  const i2c_seg_t *seg;         //!< Next chunk (vectored sends)
+  uint8_t segs;                 //!< Chunks left (vectored sends)
+  bool pec;                     //!< PEC byte pending to be sent/received
+  bool crc_on;                  //!< PEC must be updated with bytes moved
+  uint8_t crc;                  //!< PEC of bytes moved so far
+  bool selecting;               //!< Writing a mux control register
+  uint8_t mux;                  //!< Mux being written
+  uint8_t sel;                  //!< Mux control byte written
+  bool rx_part;                 //!< Receive part of a sandr under way
+} xfer;
+
+/*
+ * Multiplexers and their control register: the open channel bit, 0
+ * when all are closed, or NO_CHANNEL when unknown. Node 0 is unbound.
+ */
+#define NO_CHANNEL 0xff
+static struct {
+  uint8_t node;
+  uint8_t sel;
+} muxes[I2C_MUX_MAX];
+
+/* mux and channel of a request route */
+#define ROUTE_MUX(route) (((route) >> 3) - 1)
+#define ROUTE_CH(route)  ((route) & 07)
+
+/* bus reservation: only owner requests are served while locked */
+static volatile bool locked;
+static bool hold;             //!< Keep bus control between owner requests
+
+/* retries done by the front request of each priority class */
+static uint8_t tried[I2CQ_P];
+
+/* ticks left to end the backoff of the front of each priority class */
+static volatile uint8_t backoff_left[I2CQ_P];
+
+
+
+#ifdef I2C_STATS
+
+/* Driver statistics */
+static i2c_stats_t stats;
+static uint32_t lat_sum;   //!< Sum of latencies of served requests
+
+
+/**
+ * @brief Accounts the end of current request with status `s`.
+ */
+static void account_request(i2c_status_t s) {
+  const uint16_t lat = ticker_get_fine() - current_req->stamp;
+
+  stats.transactions++;
+  switch (s) {
+  case SlaveRejected:           stats.sla_nacks++;       break;
+  case SlaveDiscardedData:      stats.data_nacks++;      break;
+  case ReceivedMessageLenError: stats.len_errors++;      break;
+  case InternalError:           stats.internal_errors++; break;
+  case PecError:                stats.pec_errors++;      break;
+  default:                                               break;
+  }
+  if (lat < stats.lat_min) stats.lat_min = lat;
+  if (lat > stats.lat_max) stats.lat_max = lat;
+  lat_sum += lat;
+}
+
+
+/**
+ * @brief Accounts data bytes moved by hardware event `e`.
+ */
+static void account_event(uint8_t e) {
+  if (e == TW_MT_DATA_ACK || e == TW_MT_DATA_NACK ||
+      e == TW_MR_DATA_ACK || e == TW_MR_DATA_NACK)
+    stats.bytes++;
+}
+
+#endif
+
+
+/**
+ * @brief Begins to serve the queue front: throws a START to get the
+ * bus control.
+ */
+static void serve_front(void) {
+  current_req = i2cq_front(&requests);
+  xfer.rx_part = false;
+  throw_start();
+  ida_state = Starting;
+}
+
+
+/**
+ * @brief Checks if there are requests that can be served now: the
+ * highest pending class is served unless its front is backing off.
+ * Only the owner class is considered while the bus is locked.
+ */
+static bool servable(void) {
+  const uint8_t last = locked ? PRIO_OWNER : I2CQ_P - 1;
+
+  for (uint8_t p = 0; p <= last; p++)
+    if (!i2cq_is_empty_class(&requests, p))
+      return backoff_left[p] == 0;
+  return false;
+}
+
+
+/**
+ * @brief Throws a STOP to release the bus and goes to Idle state.
+ */
+static void release_bus(void) {
+  throw_stop();
+  disable_i2c_interrupts();
+  ida_state = Idle;
+}
+
+
+/**
+ * @brief Serves the next request if any can be served. Otherwise
+ * releases the bus or, if the owner asked for it, keeps it: TWINT is
+ * left set so hw stretches SCL until next owner request RESTARTs.
+ * The bus is never kept along the backoff of an owner request.
+ */
+static void serve_next(void) {
+  if (servable()) {
+    serve_front();
+  } else if (locked && hold && i2cq_is_empty_class(&requests, PRIO_OWNER)) {
+    TWCR = _BV(TWEN);   // disable interrupts without clearing TWINT
+    ida_state = Holding;
+  } else {
+    release_bus();
+  }
+}
+
+
+/*
+ * Backoffs are timed by the compare match B of the ticker timer
+ * (Timer2), whose interrupt belongs to the driver: it fires once per
+ * tick, and is only enabled while a backoff is pending. The ticker
+ * keeps its compare match A and its action.
+ */
+static void start_backoff_timer(void) {
+  if (!(TIMSK2 & _BV(OCIE2B))) {
+    OCR2B = OCR2A >> 1;
+    TIFR2 = _BV(OCF2B);        // clear a stale match
+    TIMSK2 |= _BV(OCIE2B);
+  }
+}
 
 
 /**
  * @brief Set `s` status to current request (finished) and
  *  - sends ReSTART and fetch new request from queue, or
- *  - sends STOP and goes to Idle state
+ *  - sends STOP and goes to Idle state, or
+ *  - holds the bus for the bus owner
+ * The new request is the front of the highest priority pending class.
+ * A rejected request with retries left is not finished: it is served
+ * again, after its backoff if any. Higher classes are served meanwhile.
  * 
  * @param s Status to be written to the already-finished current request.
  */
 static void fetch_or_idle(i2c_status_t s) {
+  if (s == SlaveRejected && tried[current_req->prio] < current_req->retries) {
+    // keep request at its queue front and retry it later
+    tried[current_req->prio]++;
+    STATS(stats.retries++);
+    if (current_req->backoff) {
+      backoff_left[current_req->prio] = current_req->backoff;
+      start_backoff_timer();
+    }
+    serve_next();
+    return;
+  }
+  tried[current_req->prio] = 0;
+
+  STATS(account_request(s));
   // return status if it should be returned
   if (current_req->status) *(current_req->status) = s;
-  i2cq_dequeue(&requests);
-  if (i2cq_is_empty(&requests)) {
-    throw_stop();
-    disable_i2c_interrupts();
-    ida_state = Idle;
+  i2cq_dequeue(&requests, current_req->prio);
+  // fetch next request and begin cycle again, if any
+  serve_next();
+}
+
+
+/*
+ * A tick: counts down the backoffs and, when one ends with the bus
+ * idle, serves the queue front. If the bus is locked by another
+ * client, it waits for the unlock.
+ */
+ISR(TIMER2_COMPB_vect) {
+  bool ended = false, pending = false;
+
+  for (uint8_t p = 0; p < I2CQ_P; p++)
+    if (backoff_left[p]) {
+      if (--backoff_left[p] == 0) ended = true;
+      else pending = true;
+    }
+  if (!pending) TIMSK2 &= ~_BV(OCIE2B);
+  if (ended && ida_state == Idle && servable()) serve_front();
+}
+
+
+/**
+ * @brief Normalises the current request into `xfer`.
+ */
+static void normalise(void) {
+  const i2cr_request_t *const r = current_req;
+
+  xfer.segs = 0;
+  xfer.pec = (r->pec == PecAppend || r->pec == PecCheck);
+  xfer.crc_on = (r->pec != PecNone);
+  xfer.crc = 0;
+  switch (r->rt) {
+  case I2Csend:
+    xfer.src = r->data.ue.buffer;
+    xfer.left = r->data.ue.length;
+    break;
+  case I2Creceive:
+    xfer.dst = r->data.ue.buffer;
+    xfer.left = r->data.ue.length + xfer.pec;
+    break;
+  case I2Csend_local:
+    xfer.src = r->data.local.b;
+    xfer.left = r->data.local.n;
+    break;
+  case I2Csendv:
+    xfer.seg = r->data.v.seg;
+    xfer.segs = r->data.v.n;
+    xfer.left = 0;
+    break;
+  case I2Csandr:
+    // send part: no PEC byte, the CRC goes on in the receive part
+    xfer.src = r->data.sr.s;
+    xfer.left = r->data.sr.s_length;
+    xfer.pec = false;
+    break;
+  }
+}
+
+
+/**
+ * @brief Turns `xfer` into the receive part of the current sandr. The
+ * PEC, if any, covers both parts.
+ */
+static void normalise_rx_part(void) {
+  const i2cr_request_t *const r = current_req;
+
+  xfer.pec = (r->pec == PecCheck);
+  xfer.dst = r->data.sr.r;
+  xfer.left = r->data.sr.r_length + xfer.pec;
+}
+
+
+
+/********************************************************
+ * Automata actions. One for every hardware event.
+ ********************************************************/
+
+/* Unexpected event in current state */
+static void on_unexpected(void) {
+  fetch_or_idle(InternalError);
+}
+
+
+/*
+ * Writes `sel` to the control register of mux `m`, in its own
+ * transaction. Current request is served after a RESTART.
+ */
+static void write_mux(uint8_t m, uint8_t sel) {
+  // unknown register until the write succeeds
+  muxes[m].sel = NO_CHANNEL;
+  xfer.selecting = true;
+  xfer.mux = m;
+  xfer.sel = sel;
+  xfer.src = &xfer.sel;
+  xfer.left = 1;
+  xfer.segs = 0;
+  xfer.pec = xfer.crc_on = false;
+  STATS(stats.mux_selects++);
+  throw_byte(muxes[m].node << 1 | TW_WRITE);
+  ida_state = SeekingSlaveTx;
+}
+
+
+/*
+ * Routes current request through its mux, if any. The channels of the
+ * other muxes are closed first, since devices behind them can share
+ * the node address. Then the request channel is opened, if needed.
+ * A request through an unbound mux ends with InternalError: its write
+ * would be a general call. Returns false if a mux write was started
+ * or the request ended instead.
+ */
+static bool routed(void) {
+  const uint8_t route = current_req->route;
+
+  if (!route) return true;
+  if (!muxes[ROUTE_MUX(route)].node) {
+    fetch_or_idle(InternalError);
+    return false;
+  }
+  for (uint8_t m = 0; m < I2C_MUX_MAX; m++)
+    if (m != ROUTE_MUX(route) && muxes[m].node && muxes[m].sel != 0) {
+      write_mux(m, 0);
+      return false;
+    }
+  if (muxes[ROUTE_MUX(route)].sel != _BV(ROUTE_CH(route))) {
+    write_mux(ROUTE_MUX(route), _BV(ROUTE_CH(route)));
+    return false;
+  }
+  return true;
+}
+
+
+/* START sent: the bus is available, begin messaging a node */
+static void on_start(void) {
+  uint8_t sla;
+
+  if (!routed()) return;
+  xfer.selecting = false;
+  if (xfer.rx_part)
+    normalise_rx_part();
+  else
+    normalise();
+  if (current_req->rt == I2Creceive || xfer.rx_part) {
+    sla = current_req->node << 1 | TW_READ;
+    ida_state = SeekingSlaveRx;
   } else {
-    // fetch next request and begin cycle again
-    throw_start();
-    current_req = i2cq_front(&requests);
-    ida_state = Starting;
+    sla = current_req->node << 1 | TW_WRITE;
+    ida_state = SeekingSlaveTx;
   }
+  if (xfer.crc_on) xfer.crc = crc8(xfer.crc, sla);
+  throw_byte(sla);
 }
-  
+
+
+/* Slave or data byte acknowledged: send next byte, if any */
+static void on_tx_ack(void) {
+  uint8_t b;
+
+  // skip to next non empty chunk
+  while (xfer.left == 0) {
+    if (xfer.segs == 0) {
+      if (xfer.pec) {
+        // data sent, append PEC byte
+        xfer.pec = false;
+        throw_byte(xfer.crc);
+        ida_state = TxData;
+      } else if (xfer.selecting) {
+        // mux written: RESTART to go on routing or serve the request
+        muxes[xfer.mux].sel = xfer.sel;
+        throw_start();
+        ida_state = Starting;
+      } else if (current_req->rt == I2Csandr && !xfer.rx_part) {
+        // send part done: RESTART to receive, in the same transaction
+        xfer.rx_part = true;
+        throw_start();
+        ida_state = Starting;
+      } else {
+        // No more data to send
+        fetch_or_idle(Success);
+      }
+      return;
+    }
+    xfer.src = xfer.seg->buffer;
+    xfer.left = xfer.seg->length;
+    xfer.seg++;
+    xfer.segs--;
+  }
+  xfer.left--;
+  b = *xfer.src++;
+  if (xfer.crc_on) xfer.crc = crc8(xfer.crc, b);
+  throw_byte(b);
+  ida_state = TxData;
+}
+
+
+/* Slave contacted and not available */
+static void on_sla_nack(void) {
+  fetch_or_idle(SlaveRejected);
+}
+
+
+/* Data rejected by slave */
+static void on_tx_data_nack(void) {
+  fetch_or_idle(SlaveDiscardedData);
+}
+
+
+/*
+ * Another master won the bus. The request stays at the queue front
+ * and is served again from its beginning: a sandr from its send part,
+ * since the other master may have moved the slave register pointer.
+ * It may have changed the mux channels too: they become unknown.
+ * START is held by hw until the bus is free.
+ */
+static void on_arb_lost(void) {
+  STATS(stats.arb_losts++);
+  xfer.rx_part = false;
+  for (uint8_t m = 0; m < I2C_MUX_MAX; m++) muxes[m].sel = NO_CHANNEL;
+  throw_start();
+  ida_state = Starting;
+}
+
+
+/* Slave contacted for reading: request first byte, maybe the last one */
+static void on_rx_sla_ack(void) {
+  throw_request_byte(xfer.left <= 1);
+  ida_state = RxData;
+}
+
+
+/* Byte received and acknowledged: store it and request the next one */
+static void on_rx_data_ack(void) {
+  const uint8_t b = get_byte();
+
+  if (xfer.pec) xfer.crc = crc8(xfer.crc, b);
+  *xfer.dst++ = b;
+  // If next is the last byte, it is NACKed
+  throw_request_byte(--xfer.left <= 1);
+}
+
+
+/* Last byte received (NACKed): data or the PEC byte */
+static void on_rx_data_nack(void) {
+  const uint8_t b = get_byte();
+
+  if (xfer.pec) {
+    fetch_or_idle(b == xfer.crc ? Success : PecError);
+  } else {
+    // a zero length receive reads a byte anyway: discard it
+    if (xfer.left) *xfer.dst = b;
+    fetch_or_idle(Success);
+  }
+}
+
 
 /**
  * @brief Do an automata transition after event `e`
@@ -148,123 +616,46 @@ static void fetch_or_idle(i2c_status_t s) {
  * @param e A byte containing the I2C current hardware status.
  */
 static void ida_next(uint8_t e) {
-  static uint8_t i;   //!< Index of next byte to be Rx/Tx
+  STATS(account_event(e));
 
   switch (ida_state) {
-  case Idle:
-    /* In idle state. Interrupts disabled */
-    if (e == TW_GO_OPERATIVE) {
-      // get next request, must exist for sure
-      current_req = i2cq_front(&requests);
-      // Throw a START to get the bus control
-      throw_start();
-      // next state
-      ida_state = Starting;
-    } else {
-      // unexpected event
-      fetch_or_idle(InternalError);
-    }
-    break;
-
   case Starting:
     /* START sent, waiting it to finish */
-    if (e == TW_START || e == TW_REP_START) {
-      // The bus is available, begin messaging a node
-      i = 0;
-      if (current_req->rt == I2Creceive) {        
-        throw_byte(current_req->node << 1 | TW_READ);
-        ida_state = SeekingSlaveRx;
-      } else {
-        // I2Csend and I2Csend_uint8
-        throw_byte((current_req->node << 1) | TW_WRITE);
-        ida_state = SeekingSlaveTx;
-      }
-    } else {
-      // unexpected event
-      fetch_or_idle(InternalError);
-    }
+    if (e == TW_START || e == TW_REP_START) on_start();
+    else on_unexpected();
     break;
 
   case SeekingSlaveTx:
-    if (e == TW_MT_SLA_ACK) {
-      // Slave contacted, let's talk with him
-      if (current_req->rt == I2Csend){
-        throw_byte(current_req->data.ue.buffer[i++]);
-      } else if (current_req->rt == I2Csend_2uint8){
-        throw_byte(current_req->data.local_2byte[i++]);
-      } else if (current_req->rt == I2Csend_uint8){
-        throw_byte(current_req->data.local_byte);
-        i++;
-      }
-      ida_state = TxData;
-    } else if (e == TW_MT_SLA_NACK) {
-      // Slave contacted and not available
-      fetch_or_idle(SlaveRejected);
-    } else {
-      // Unexpected event
-      fetch_or_idle(InternalError);
-    }
+    if (e == TW_MT_SLA_ACK) on_tx_ack();
+    else if (e == TW_MT_SLA_NACK) on_sla_nack();
+    else if (e == TW_MT_ARB_LOST) on_arb_lost();
+    else on_unexpected();
     break;
 
   case TxData:
-    if (e == TW_MT_DATA_ACK) {
-      // Data sent ok
-      if (current_req->rt == I2Csend &&
-	  i < current_req->data.ue.length) {
-        // Send another byte and remain in the same state
-        throw_byte(current_req->data.ue.buffer[i++]);
-      } else if (current_req->rt == I2Csend_2uint8 &&
-	  i < 2) {
-        // Send another byte and remain in the same state
-        throw_byte(current_req->data.local_2byte[i++]);
-      } else {
-        // No more data to send
-        fetch_or_idle(Success);
-      }
-    } else if (e == TW_MT_DATA_NACK) {      
-      // Data rejected by slave
-      fetch_or_idle(SlaveDiscardedData);
-    } else {
-      // Unexpected event
-      fetch_or_idle(InternalError);
-    }
+    if (e == TW_MT_DATA_ACK) on_tx_ack();
+    else if (e == TW_MT_DATA_NACK) on_tx_data_nack();
+    else if (e == TW_MT_ARB_LOST) on_arb_lost();
+    else on_unexpected();
     break;
-    
+
   case SeekingSlaveRx:
-    if (e == TW_MR_SLA_ACK) {
-      // Slave contacted, let's talk with him
-      // First byte is received. Maybe the last one
-      // current_req->data.ue.buffer[i++] = get_byte();   ??????????????????
-      throw_request_byte(false);
-      ida_state = RxData;
-    } else if (e == TW_MR_SLA_NACK) {
-      // Slave contacted and not available
-      fetch_or_idle(SlaveRejected);
-    } else {
-      // Unexpected event
-      fetch_or_idle(InternalError);
-    }
+    if (e == TW_MR_SLA_ACK) on_rx_sla_ack();
+    else if (e == TW_MR_SLA_NACK) on_sla_nack();
+    else if (e == TW_MR_ARB_LOST) on_arb_lost();
+    else on_unexpected();
     break;
 
   case RxData:
-    if (e == TW_MR_DATA_ACK) {
-      // Get another byte and remain in the same state
-      current_req->data.ue.buffer[i++] = get_byte();
-      //If this was the last byte, next event will be TW_MR_DATA_NACK
-      throw_request_byte(current_req->data.ue.length == i);
-    } else if (e == TW_MR_DATA_NACK) {
-      // Check if all expected data was received
-      if (current_req->data.ue.length == i) {
-        // No more data to receive
-        fetch_or_idle(Success);
-      } else {
-        // Received a block shorter than expected
-        fetch_or_idle(ReceivedMessageLenError);
-      }
-    } else {
-      // Unexpected event
-      fetch_or_idle(InternalError);
-    }
+    if (e == TW_MR_DATA_ACK) on_rx_data_ack();
+    else if (e == TW_MR_DATA_NACK) on_rx_data_nack();
+    else if (e == TW_MR_ARB_LOST) on_arb_lost();
+    else on_unexpected();
+    break;
+
+  default:
+    /* Idle, Holding: interrupts disabled, no event expected */
+    on_unexpected();
     break;
   }
 }
@@ -295,77 +686,216 @@ void i2c_setup(void) {
 
 
 void i2c_open(void) {
+  STATS(i2c_stats_reset());
   i2cq_empty(&requests);
+  locked = false;
+  for (uint8_t p = 0; p < I2CQ_P; p++) tried[p] = backoff_left[p] = 0;
+  for (uint8_t m = 0; m < I2C_MUX_MAX; m++) muxes[m].sel = NO_CHANNEL;
   ida_state = Idle;
   TWCR = _BV(TWEN);  // Enable I2C module
 }
 
 
+/* No request is pending nor being served (backoffs included) */
+static bool drained(void) {
+  bool d;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    d = ida_state == Idle && i2cq_is_empty(&requests);
+  }
+  return d;
+}
+
+
 void i2c_close(void) {
-  while(ida_state != Idle);           // Wait till queue empty
+  i2c_unlock();                       // Release the bus if held
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    // retry now: the ticker may be stopped
+    for (uint8_t p = 0; p < I2CQ_P; p++) backoff_left[p] = 0;
+    TIMSK2 &= ~_BV(OCIE2B);
+    if (ida_state == Idle && servable()) serve_front();
+  }
+  while(!drained());                  // Wait till queue empty
   TWCR = 0;                           // Disable I2C module
 }
 
 
 bool i2c_swamped(void) {
-  return i2cq_is_full(&requests);
+  return i2cq_is_full(&requests, PRIO_NORMAL);
+}
+
+
+uint8_t i2c_room(bool urgent) {
+  return i2cq_room(&requests, urgent ? PRIO_URGENT : PRIO_NORMAL);
+}
+
+
+bool i2c_lock(bool h) {
+  bool taken = false;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (!locked) {
+      locked = taken = true;
+      hold = h;
+    }
+  }
+  return taken;
+}
+
+
+void i2c_unlock(void) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    locked = false;
+    // serve requests that waited for the owner
+    if (ida_state == Holding) {
+      serve_next();
+    } else if (ida_state == Idle && servable()) {
+      serve_front();
+    }
+  }
 }
 
 
+void i2c_mux_bind(uint8_t mux, i2c_addr_t node) {
+  if (mux >= I2C_MUX_MAX) return;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    muxes[mux].node = node & NODE_MASK;
+    muxes[mux].sel = NO_CHANNEL;
+  }
+}
+
+
+#ifdef I2C_STATS
+
+void i2c_stats(i2c_stats_t *const st) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    *st = stats;
+    st->lat_avg = stats.transactions ? lat_sum / stats.transactions : 0;
+  }
+}
+
+
+void i2c_stats_reset(void) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    stats = (i2c_stats_t){ .lat_min = UINT16_MAX };
+    lat_sum = 0;
+  }
+}
+
+#endif
+
+
 
 /*************************************************************
  * Block transmision operations
  *************************************************************/
 
+/*
+ * Folds the byte send `r` into the rear request of its class if
+ * possible. Must be called atomically.
+ * Returns true iff `r` was folded.
+ */
+static bool combine(const i2cr_request_t *const r) {
+  i2cr_request_t *const t = i2cq_rear(&requests, r->prio);
+
+  // the request being served cannot be touched
+  if (!t || t == current_req ||
+      t->rt != I2Csend_local || t->node != r->node || t->route != r->route ||
+      t->pec != PecNone || r->pec != PecNone ||
+      t->retries != r->retries || t->backoff != r->backoff ||
+      t->data.local.n + r->data.local.n > I2CR_LOCAL_L ||
+      (t->status && r->status && t->status != r->status))
+    return false;
+
+  memcpy(&t->data.local.b[t->data.local.n], r->data.local.b, r->data.local.n);
+  t->data.local.n += r->data.local.n;
+  if (r->status) t->status = r->status;
+  STATS(stats.combined++);
+  return true;
+}
+
+
 /*
  * factorizes a common task of all operations
  */
-static void put_request(const i2cr_request_t *const r) {
+static void put_request(i2cr_request_t *const r) {
+  // interrupts disabled: called from an ISR, room cannot be waited for
+  const bool can_wait = SREG & _BV(SREG_I);
+  const bool combinable =
+    (r->node & I2C_COMBINE(0)) && r->rt == I2Csend_local;
+  bool combined = false;
+
   // initialize the status to Running if needed
   if (r->status) *(r->status) = Running;
 
-  // protects a queue modification using some operation of
-  // this module from an ISR.
-  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-    while (i2cq_is_full(&requests));
-    i2cq_enqueue(&requests, r);
+  // split request flags from node address
+  r->prio = (r->node & I2C_OWNED(0))  ? PRIO_OWNER
+          : (r->node & I2C_URGENT(0)) ? PRIO_URGENT : PRIO_NORMAL;
+  if (!(r->node & I2C_PEC(0)))
+    r->pec = PecNone;
+  else
+    r->pec = (r->rt == I2Creceive || r->rt == I2Csandr) ? PecCheck : PecAppend;
+  r->route = (r->node >> 10) & 037;
+  r->node &= NODE_MASK;
+  STATS(r->stamp = ticker_get_fine());
+
+  if (combinable) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      combined = combine(r);
+    }
+    if (combined) return;
+  }
 
-    if (ida_state == Idle){
-      //Start the automata
-      ida_next(TW_GO_OPERATIVE);
+  // Room is checked and the request queued in the same atomic block:
+  // otherwise an ISR submitter could fill the class in between and
+  // the request would be lost. While the class is full, interrupts
+  // are enabled between tries: only the ISR can make room.
+  for (bool counted = false; ; counted = true) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      if (!i2cq_is_full(&requests, r->prio)) {
+        i2cq_enqueue(&requests, r);
+        if ((ida_state == Idle || ida_state == Holding) && servable()) {
+          //Start the automata (RESTART if holding the bus)
+          serve_front();
+        }
+        return;
+      }
+      if (!can_wait || (locked && r->prio != PRIO_OWNER)) {
+        // an ISR submitter, or a class waiting for the bus owner,
+        // that may be a thread of this same loop: spinning could
+        // never end
+        STATS(stats.queue_full++);
+        if (r->status) *(r->status) = Busy;
+        return;
+      }
     }
+    if (!counted) STATS(stats.queue_full++);
   }
 }  
 
 
 void i2c_send(i2c_addr_t node,
 	      uint8_t *const  buffer,
-	      uint8_t length,
+	      uint16_t length,
 	      volatile i2c_status_t *const  status) {
-  i2cr_request_t r = {
-    .rt = I2Csend,
-    .node = node,
-    .status = status,
-    .data.ue = { .buffer = buffer, .length = length},
-  };
-
-  put_request(&r);
+  i2c_send_retry(node, buffer, length, 0, 0, status);
 }
 
 
 
 void i2c_receive(i2c_addr_t node,
 		 uint8_t *const buffer,
-		 uint8_t length,
+		 uint16_t length,
 		 volatile i2c_status_t *const  status) {
-  i2cr_request_t r = {
-    .rt = I2Creceive,
-    .node = node,
-    .status = status,
-    .data.ue = {.buffer = buffer, .length = length},
-  };
+  i2c_receive_retry(node, buffer, length, 0, 0, status);
+}
 
-  put_request(&r);
+
+void i2c_sendv(i2c_addr_t node,
+	       const i2c_seg_t *const segs,
+	       uint8_t n,
+	       volatile i2c_status_t *const status) {
+  i2c_sendv_retry(node, segs, n, 0, 0, status);
 }
 
 
@@ -376,14 +906,7 @@ void i2c_receive(i2c_addr_t node,
 void i2c_send_2uint8(i2c_addr_t node,
 		     uint8_t b1, uint8_t b0,
 		     volatile i2c_status_t *const status) {
-  i2cr_request_t r = {
-    .rt = I2Csend_2uint8,
-    .node = node,
-    .status = status,
-    .data.local_2byte = {b1,b0}
-  };
-  
-  put_request(&r);
+  i2c_send_2uint8_retry(node, b1, b0, 0, 0, status);
 }
 
 
@@ -391,10 +914,10 @@ void i2c_send_uint8(i2c_addr_t node,
 		    uint8_t b,
 		    volatile i2c_status_t *const status) {
   i2cr_request_t r = {
-    .rt = I2Csend_uint8,
+    .rt = I2Csend_local,
     .node = node,
     .status = status,
-    .data.local_byte = b
+    .data.local = {.b = {b}, .n = 1}
   };
   
   put_request(&r);
@@ -417,18 +940,132 @@ void i2c_receive_uint8(i2c_addr_t node,
 }
 
 
+void i2c_probe(i2c_addr_t node,
+	       volatile i2c_status_t *const status) {
+  // a vectored send without segments sends just the address
+  i2cr_request_t r = {
+    .rt = I2Csendv,
+    .node = node,
+    .status = status,
+    .data.v = {.seg = NULL, .n = 0},
+  };
+
+  put_request(&r);
+}
+
+
 /*************************************************************
  * Combined transmision operations
  *************************************************************/
 
 void i2c_sandr(i2c_addr_t node,
 	       uint8_t *const  s_buffer,
-	       uint8_t s_length,
+	       uint16_t s_length,
 	       uint8_t *const  r_buffer,
-	       uint8_t r_length,
+	       uint16_t r_length,
 	       volatile i2c_status_t *const status) {
-  i2c_send(node, s_buffer, s_length, NULL);
-  i2c_receive(node, r_buffer, r_length, status);
+  i2c_sandr_retry(node, s_buffer, s_length, r_buffer, r_length, 0, 0,
+		  status);
+}
+
+
+
+/*************************************************************
+ * Retried operations
+ *************************************************************/
+
+void i2c_send_retry(i2c_addr_t node,
+		    uint8_t *const buffer,
+		    uint16_t length,
+		    uint8_t attempts, uint8_t backoff,
+		    volatile i2c_status_t *const status) {
+  i2cr_request_t r = {
+    .rt = I2Csend,
+    .node = node,
+    .status = status,
+    .retries = attempts,
+    .backoff = backoff,
+    .data.ue = { .buffer = buffer, .length = length},
+  };
+
+  put_request(&r);
+}
+
+
+void i2c_receive_retry(i2c_addr_t node,
+		       uint8_t *const buffer,
+		       uint16_t length,
+		       uint8_t attempts, uint8_t backoff,
+		       volatile i2c_status_t *const status) {
+  i2cr_request_t r = {
+    .rt = I2Creceive,
+    .node = node,
+    .status = status,
+    .retries = attempts,
+    .backoff = backoff,
+    .data.ue = {.buffer = buffer, .length = length},
+  };
+
+  put_request(&r);
+}
+
+
+void i2c_sendv_retry(i2c_addr_t node,
+		     const i2c_seg_t *const segs,
+		     uint8_t n,
+		     uint8_t attempts, uint8_t backoff,
+		     volatile i2c_status_t *const status) {
+  i2cr_request_t r = {
+    .rt = I2Csendv,
+    .node = node,
+    .status = status,
+    .retries = attempts,
+    .backoff = backoff,
+    .data.v = {.seg = segs, .n = n},
+  };
+
+  put_request(&r);
+}
+
+
+void i2c_send_2uint8_retry(i2c_addr_t node,
+			   uint8_t b1, uint8_t b0,
+			   uint8_t attempts, uint8_t backoff,
+			   volatile i2c_status_t *const status) {
+  i2cr_request_t r = {
+    .rt = I2Csend_local,
+    .node = node,
+    .status = status,
+    .retries = attempts,
+    .backoff = backoff,
+    .data.local = {.b = {b1,b0}, .n = 2}
+  };
+
+  put_request(&r);
+}
+
+
+void i2c_sandr_retry(i2c_addr_t node,
+		     uint8_t *const s_buffer,
+		     uint16_t s_length,
+		     uint8_t *const r_buffer,
+		     uint16_t r_length,
+		     uint8_t attempts, uint8_t backoff,
+		     volatile i2c_status_t *const status) {
+  // a single request: nothing can be served between its parts
+  i2cr_request_t r = {
+    .rt = I2Csandr,
+    .node = node,
+    .status = status,
+    .retries = attempts,
+    .backoff = backoff,
+    .data.sr = {
+      .s = s_buffer, .s_length = s_length,
+      .r = r_buffer, .r_length = r_length,
+    },
+  };
+
+  put_request(&r);
 }
 
 
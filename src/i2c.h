@@ -13,15 +13,89 @@
 typedef enum {
   Running=0,
   Success,
-  ReceivedMessageLenError,
+  ReceivedMessageLenError,     /* not returned anymore, see below */
   SlaveRejected,
   SlaveDiscardedData,
   InternalError,
+  PecError,
+  Busy,
 } i2c_status_t;
 
 
-/* An i2c node address */
-typedef uint8_t i2c_addr_t;
+/*
+ * ReceivedMessageLenError: no longer returned. Receives read exactly
+ * the requested bytes, NACKing the last one, so a message can not be
+ * shorter than expected. The value is kept for source compatibility.
+ *
+ * Busy: the request was not queued. Its priority class was full and
+ * the submitter could not wait for room: it was called from an ISR
+ * (interrupts disabled), or the bus is reserved by another client and
+ * the class only drains after i2c_unlock(). See i2c_room().
+ */
+
+/*
+ * An i2c node address: a 7 bit node address, optionally OR'ed with
+ * request flags (see I2C_URGENT, I2C_PEC).
+ */
+typedef uint16_t i2c_addr_t;
+
+/*
+ * Urgent request node address. Requests to `I2C_URGENT(node)` are
+ * addressed to `node` but they are served before any pending non
+ * urgent request. Urgent requests keep FIFO order between them.
+ */
+#define I2C_URGENT(node) ((i2c_addr_t)((node) | 0x80))
+
+/*
+ * SMBus packet error checking node address. Sends to `I2C_PEC(node)`
+ * append a CRC-8 PEC byte to the data. Receives read a PEC byte after
+ * the data and check it: they end with PecError if it does not match.
+ * The send part of i2c_sandr() does not append a PEC byte; its bytes
+ * are covered by the PEC of the receive part, as SMBus reads need.
+ */
+#define I2C_PEC(node) ((i2c_addr_t)((node) | 0x100))
+
+/*
+ * Write combining node address. A byte send (i2c_send_uint8(),
+ * i2c_send_2uint8()) to `I2C_COMBINE(node)` can be folded into the
+ * last byte send queued to `node`, if it is still waiting and there
+ * is room, and they are sent in a single transaction. Only for devices
+ * that take every byte written the same way whether it comes in its
+ * own transaction or not, as PCF8574 port expanders.
+ */
+#define I2C_COMBINE(node) ((i2c_addr_t)((node) | 0x200))
+
+/*
+ * Bus owner node address. While the bus is locked (see i2c_lock()),
+ * only requests to `I2C_OWNED(node)` are served. The other requests
+ * wait in the queue. Owner requests are served before any other.
+ */
+#define I2C_OWNED(node) ((i2c_addr_t)((node) | 0x8000))
+
+/* max number of i2c multiplexers */
+#define I2C_MUX_MAX 3
+
+/*
+ * Multiplexed node address. Requests to `I2C_MUXED(mux, ch, node)`
+ * are addressed to `node` behind channel `ch` (0..7) of the TCA9548A
+ * like multiplexer number `mux` (0..I2C_MUX_MAX-1, see
+ * i2c_mux_bind()). The driver tracks the channel selected in every
+ * mux: the channel is selected, as part of the request, only when it
+ * changes. The channels of the other muxes are closed before, so
+ * devices behind distinct muxes can share their address.
+ * `mux` must be a constant: a `mux` out of range does not compile.
+ */
+#define I2C_MUXED(mux, ch, node) \
+  ((i2c_addr_t)((node) | ((ch) & 07) << 10 | (((mux) + 1) & 03) << 13 \
+                | 0 * sizeof(struct {                                  \
+                    int ok : (mux) < I2C_MUX_MAX ? 1 : -1; })))
+
+
+/* A segment of a vectored (scatter-gather) send */
+typedef struct {
+  const uint8_t *buffer;  /* segment bytes */
+  uint16_t length;        /* number of bytes in the segment */
+} i2c_seg_t;
 
 
 /******************************************************************
@@ -44,17 +118,113 @@ void i2c_open(void);
 /**
  * @brief Closes the i2c channel.
  * It's mandatory to call it before exiting the application. A closed i2c channel
- * can be reopened later if needed.
+ * can be reopened later if needed. Ends the bus reservation, if any, and
+ * waits for the queued requests to be served.
  */
 void i2c_close(void);
 
 /**
  * @brief Checks if right now i2c driver can receive more requests.
+ * Urgent requests have their own room and are not considered.
  * 
  * @returns true iff i2c driver cannot receive more requests.
  */
 bool i2c_swamped(void);
 
+/**
+ * @brief Gets how many requests can be received right now without
+ * blocking. Useful to submit requests from an ISR, where blocking is
+ * not allowed: a request submitted from an ISR with no room is not
+ * queued and ends with status Busy.
+ *
+ * @param urgent: true to query the room for urgent requests.
+ * @returns the number of requests that can be received.
+ */
+uint8_t i2c_room(bool urgent);
+
+/**
+ * @brief Tries to reserve the bus for a sequence of requests.
+ *
+ * While reserved, only requests addressed to `I2C_OWNED(node)` are
+ * served; the request in progress, if any, ends first. Requests of
+ * other clients are queued and wait for i2c_unlock(). They never
+ * block: if their class is full they are not queued and end with
+ * status Busy, since the owner could be a thread blocked by them.
+ * From a protothread: `PT_WAIT_UNTIL(pt, i2c_lock(false));`
+ *
+ * @param hold: If true, the bus is not released (no STOP) when there
+ *              are no owner requests left: the next owner request is
+ *              sent after a repeated START. SCL is held low meanwhile,
+ *              thus keep it short (SMBus devices time out at 25 ms).
+ * @returns true iff the bus was reserved. False if already reserved.
+ */
+bool i2c_lock(bool hold);
+
+/**
+ * @brief Ends the bus reservation. Waiting requests are served.
+ * Also done by i2c_close().
+ */
+void i2c_unlock(void);
+
+/**
+ * @brief Binds multiplexer number `mux` (0..I2C_MUX_MAX-1) to the
+ * node address `node`. Its selected channel becomes unknown: the next
+ * request through it will select its channel, and the next request
+ * through another mux will close its channels. Rebind it if the mux
+ * channel was changed behind the driver (for instance, by a reset).
+ * Out of range `mux` numbers are ignored.
+ *
+ * @param mux:  Multiplexer number.
+ * @param node: Multiplexer node address.
+ */
+void i2c_mux_bind(uint8_t mux, i2c_addr_t node);
+
+
+
+/******************************************************************
+ * Driver statistics (only if compiled with I2C_STATS defined)
+ ******************************************************************/
+
+#ifdef I2C_STATS
+
+/* 
+ * Driver statistics. Latencies measure the time from a request
+ * submission to its completion, in ticker_get_fine() units (64 us).
+ * Ticker must be running to get meaningful latencies.
+ */
+typedef struct {
+  uint32_t transactions;     /* requests served (whatever the result) */
+  uint32_t bytes;            /* data bytes sent and received */
+  uint16_t sla_nacks;        /* requests ended with SlaveRejected */
+  uint16_t data_nacks;       /* requests ended with SlaveDiscardedData */
+  uint16_t len_errors;       /* ReceivedMessageLenError: always 0 */
+  uint16_t internal_errors;  /* requests ended with InternalError */
+  uint16_t pec_errors;       /* requests ended with PecError */
+  uint16_t queue_full;       /* submissions that found no room */
+  uint16_t combined;         /* sends folded into a queued one */
+  uint16_t mux_selects;      /* mux channel selections */
+  uint16_t arb_losts;        /* arbitrations lost to other masters */
+  uint16_t retries;          /* requests retried after a rejection */
+  uint16_t lat_min;          /* min request latency */
+  uint16_t lat_avg;          /* mean request latency */
+  uint16_t lat_max;          /* max request latency */
+} i2c_stats_t;
+
+/**
+ * @brief Gets the driver statistics collected since the last reset.
+ *
+ * @param s: A pointer to where the statistics will be copied.
+ */
+void i2c_stats(i2c_stats_t *const s);
+
+/**
+ * @brief Resets the driver statistics.
+ * Also done by i2c_open().
+ */
+void i2c_stats_reset(void);
+
+#endif
+
 
 
 /******************************************************************
@@ -76,7 +246,8 @@ bool i2c_swamped(void);
  * 
  * @param node: The I2C byte address of the receiver.
  * @param buffer: A pointer to the byte array where the message is saved.
- * @param length: The number of bytes to be sent from the buffer.    
+ * @param length: The number of bytes to be sent from the buffer. Up to
+ *                65535 bytes are sent in a single transaction.
  * @param status: A pointer to a `volatile i2c_status_t` variable that 
  *               contains the current status of the request. If NULL, then
  *               no status will be reported (not recommeded).
@@ -85,7 +256,7 @@ bool i2c_swamped(void);
  */
 void i2c_send(i2c_addr_t node,
 	      uint8_t *const  buffer,
-	      uint8_t lenght,
+	      uint16_t lenght,
 	      volatile i2c_status_t *const status);
 
 /**
@@ -103,7 +274,8 @@ void i2c_send(i2c_addr_t node,
  * 
  * @param node:   The I2C byte address of the sender.
  * @param buffer: A pointer to a byte array where the message will be saved.
- * @param length: The number of bytes to be received from the buffer.
+ * @param length: The number of bytes to be received from the buffer. Up
+ *                to 65535 bytes are received in a single transaction.
  * @param status: A pointer to a `volatile i2c_status_t` variable 
  *                that contains the status of the request. If NULL, them
  *                no status will be reported (not recommended).
@@ -112,9 +284,39 @@ void i2c_send(i2c_addr_t node,
  */
 void i2c_receive(i2c_addr_t node,
 		 uint8_t *const buffer,
-		 uint8_t lenght,
+		 uint16_t lenght,
 		 volatile i2c_status_t *const  status);
 
+/**
+ * @brief Request the driver to (asyncronously) send to `node`
+ * the concatenation of the `n` segments in `segs`, all in a single
+ * transaction.
+ * `*status` has the current state of the request:
+ *  - Running: while request not scheduled
+ *  - Success: when request ended satifactorily
+ *  - Other values: when request ended with an error condition.
+ *
+ * Segments are sent in order and empty segments are skipped. Neither
+ * `*status`, `segs` nor the segment buffers can be disposed until
+ * send request execution finished. This avoids copying, say, a
+ * register address and a payload into a single staging buffer.
+ * If the i2d driver cannot receive more requests, the call blocks
+ * until this request can be accepted.
+ * 
+ * @param node:   The I2C byte address of the receiver.
+ * @param segs:   A pointer to an array of `n` segments.
+ * @param n:      The number of segments in `segs`.
+ * @param status: A pointer to a `volatile i2c_status_t` variable that 
+ *                contains the current status of the request. If NULL,
+ *                then no status will be reported (not recommeded).
+ * @pre   n > 0
+ * @post *status == Running if status != NULL
+ */
+void i2c_sendv(i2c_addr_t node,
+	       const i2c_seg_t *const segs,
+	       uint8_t n,
+	       volatile i2c_status_t *const status);
+
 
 
 /******************************************************************
@@ -232,6 +434,24 @@ void i2c_receive_uint8(i2c_addr_t node,
 
 
 
+/**
+ * @brief Asyncronously probes an i2c node.
+ *
+ * Only the node address is sent: no data is transferred. `*status`
+ * becomes Success if the node acknowledged it and SlaveRejected
+ * otherwise. Useful to scan the bus or to poll a busy device.
+ *
+ * @param node:   The I2C byte address of the node.
+ * @param status: A pointer to a `volatile i2c_status_t` variable 
+ *                that contains the current state of the request. If
+ *                NULL, no status will be reported (not recommended).
+ * @post *status == Running if status != NULL
+ */
+void i2c_probe(i2c_addr_t node,
+	       volatile i2c_status_t *const status);
+
+
+
 /******************************************************************
  * Send and then receive blocks
  ******************************************************************/
@@ -239,8 +459,10 @@ void i2c_receive_uint8(i2c_addr_t node,
 /**
  * @brief Sends a message and then reads
  *
- * Equivalent to first sending the message and then receiving the result.
- * `*status` corresponds to receive operation.
+ * Sends the message and then, after a repeated START, receives the
+ * result: a single request, so no other request is served between
+ * both parts. `*status` corresponds to the whole operation: if the
+ * send part fails, nothing is received.
  *
  * @param node:     Slave node address
  * @param s_buffer: Pointer to send message buffer
@@ -256,10 +478,79 @@ void i2c_receive_uint8(i2c_addr_t node,
  */
 void i2c_sandr(i2c_addr_t node,
 	       uint8_t *const  s_buffer,
-	       uint8_t s_lenght,
+	       uint16_t s_lenght,
 	       uint8_t *const  r_buffer,
-	       uint8_t r_lenght,
+	       uint16_t r_lenght,
 	       volatile i2c_status_t *const status);
 
 
+
+/******************************************************************
+ * Retried operations
+ *
+ * As the operations above, with a retry policy for devices that do
+ * not acknowledge their address while busy (e.g. converting). A
+ * request whose slave does not acknowledge its address is not
+ * finished with SlaveRejected while it has retries left. Instead, the
+ * bus is released and the request is served again after `backoff`
+ * ticks, keeping its place in the queue. Its status remains Running
+ * meanwhile. Requests behind it wait, but higher classes (urgent, bus
+ * owner) are served.
+ *
+ * Backoff is timed by the driver from the ticker timer (compare match
+ * B of Timer2): the ticker must be running. i2c_close() retries at
+ * once the requests still backing off.
+ *
+ * attempts: Max number of retries of the request.
+ * backoff:  Ticks to wait before every retry (0: retry at once).
+ ******************************************************************/
+
+/**
+ * @brief i2c_send() with `attempts` retries, `backoff` ticks apart.
+ */
+void i2c_send_retry(i2c_addr_t node,
+		    uint8_t *const buffer,
+		    uint16_t length,
+		    uint8_t attempts, uint8_t backoff,
+		    volatile i2c_status_t *const status);
+
+/**
+ * @brief i2c_receive() with `attempts` retries, `backoff` ticks apart.
+ */
+void i2c_receive_retry(i2c_addr_t node,
+		       uint8_t *const buffer,
+		       uint16_t length,
+		       uint8_t attempts, uint8_t backoff,
+		       volatile i2c_status_t *const status);
+
+/**
+ * @brief i2c_sendv() with `attempts` retries, `backoff` ticks apart.
+ */
+void i2c_sendv_retry(i2c_addr_t node,
+		     const i2c_seg_t *const segs,
+		     uint8_t n,
+		     uint8_t attempts, uint8_t backoff,
+		     volatile i2c_status_t *const status);
+
+/**
+ * @brief i2c_send_2uint8() with `attempts` retries, `backoff` ticks
+ * apart.
+ */
+void i2c_send_2uint8_retry(i2c_addr_t node,
+			   uint8_t b1, uint8_t b0,
+			   uint8_t attempts, uint8_t backoff,
+			   volatile i2c_status_t *const status);
+
+/**
+ * @brief i2c_sandr() with `attempts` retries, `backoff` ticks apart.
+ */
+void i2c_sandr_retry(i2c_addr_t node,
+		     uint8_t *const s_buffer,
+		     uint16_t s_length,
+		     uint8_t *const r_buffer,
+		     uint16_t r_length,
+		     uint8_t attempts, uint8_t backoff,
+		     volatile i2c_status_t *const status);
+
+
 #endif
@@ -0,0 +1,144 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "pt.h"
+#include "serial.h"
+#include "i2c.h"
+#include "i2cb.h"
+
+
+/* an operation of the current frame */
+typedef struct {
+  uint8_t kind;
+  uint8_t node;
+  uint8_t wlen, rlen;
+  uint8_t *w, *r;               // data sent and received, in `buf`
+  bool rejected;
+  volatile i2c_status_t st;
+} op_t;
+
+
+/*
+ * Protothread state. Protothreads do not keep local variables, thus
+ * they are all static.
+ */
+static op_t ops[I2CB_OPS];
+static uint8_t buf[I2CB_BUF];
+static uint8_t n;               // operations in current frame
+static uint8_t i;               // current operation
+static uint8_t j;               // current byte of current operation
+static uint8_t used;            // bytes of `buf` used by the frame
+static uint8_t hdr[4];          // operation header being received
+
+
+
+/*
+ * Checks the header of operation `o` and places its data in `buf`.
+ * Marks it as rejected if it cannot be run.
+ */
+static void place(op_t *const o) {
+  o->kind = hdr[0];
+  o->node = hdr[1];
+  o->wlen = hdr[2];
+  o->rlen = hdr[3];
+
+  // ignore lengths not used by the operation
+  if (o->kind == I2CB_READ || o->kind == I2CB_PROBE) o->wlen = 0;
+  if (o->kind == I2CB_WRITE || o->kind == I2CB_PROBE) o->rlen = 0;
+
+  o->rejected =
+    (o->kind != I2CB_WRITE && o->kind != I2CB_READ &&
+     o->kind != I2CB_WRITE_READ && o->kind != I2CB_PROBE) ||
+    o->wlen + o->rlen > I2CB_BUF - used;
+  if (!o->rejected) {
+    o->w = &buf[used];
+    o->r = &buf[used + o->wlen];
+    used += o->wlen + o->rlen;
+  }
+}
+
+
+/* Submits operation `o` to the i2c driver. There must be room. */
+static void submit(op_t *const o) {
+  switch (o->kind) {
+  case I2CB_WRITE:
+    i2c_send(o->node, o->w, o->wlen, &o->st);
+    break;
+  case I2CB_READ:
+    i2c_receive(o->node, o->r, o->rlen, &o->st);
+    break;
+  case I2CB_WRITE_READ:
+    i2c_sandr(o->node, o->w, o->wlen, o->r, o->rlen, &o->st);
+    break;
+  case I2CB_PROBE:
+    i2c_probe(o->node, &o->st);
+    break;
+  }
+}
+
+
+/* true iff the reply to operation `o` carries its received bytes */
+static bool replies_data(const op_t *const o) {
+  return !o->rejected && o->st == Success && o->rlen > 0;
+}
+
+
+
+/* waits for a byte from serial port and stores it in `v` */
+#define GET(pt, v) \
+  do { PT_WAIT_UNTIL(pt, serial_can_read()); (v) = serial_read(); } while (0)
+
+/* waits for room in serial port and writes byte `v` */
+#define PUT(pt, v) \
+  do { PT_WAIT_UNTIL(pt, serial_can_write()); serial_write(v); } while (0)
+
+
+PT_THREAD(i2cb_run(struct pt *pt))
+{
+  PT_BEGIN(pt);
+
+  for (;;) {
+    /* frame header */
+    do {
+      GET(pt, hdr[0]);
+    } while (hdr[0] != I2CB_SYNC);
+    GET(pt, n);
+    if (n > I2CB_OPS) {
+      // frame too long: empty reply and resync
+      PUT(pt, I2CB_SYNC);
+      PUT(pt, 0);
+      continue;
+    }
+
+    /* receive and submit operations */
+    used = 0;
+    for (i = 0; i < n; i++) {
+      for (j = 0; j < sizeof(hdr); j++) GET(pt, hdr[j]);
+      place(&ops[i]);
+      // data to be sent, discarded if rejected
+      for (j = 0; j < hdr[2]; j++) {
+	if (ops[i].rejected || j >= ops[i].wlen) {
+	  GET(pt, hdr[0]);
+	} else {
+	  GET(pt, ops[i].w[j]);
+	}
+      }
+      if (!ops[i].rejected) {
+	// never block into the driver: wait for room here
+	PT_WAIT_UNTIL(pt, i2c_room(ops[i].node & I2C_URGENT(0)));
+	submit(&ops[i]);
+      }
+    }
+
+    /* stream results back, in order, as operations end */
+    PUT(pt, I2CB_SYNC);
+    PUT(pt, n);
+    for (i = 0; i < n; i++) {
+      PT_WAIT_WHILE(pt, !ops[i].rejected && ops[i].st == Running);
+      PUT(pt, ops[i].rejected ? I2CB_REJECTED : ops[i].st);
+      if (replies_data(&ops[i]))
+	for (j = 0; j < ops[i].rlen; j++) PUT(pt, ops[i].r[j]);
+    }
+  }
+
+  PT_END(pt);
+}
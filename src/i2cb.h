@@ -0,0 +1,71 @@
+#ifndef _I2CB_H_
+#define _I2CB_H_
+
+/*
+ * i2c over serial bridge
+ *
+ * Lets a host drive the i2c bus through the serial port. The host
+ * sends frames, each one a batch of i2c operations. Operations are
+ * submitted to the i2c driver as soon as they are received, so the
+ * bus works while the rest of the frame is still arriving. When all
+ * the operations of a frame ended, a reply frame with their statuses
+ * and received data is sent back.
+ *
+ * Request frame (all fields are bytes):
+ *
+ *   I2CB_SYNC n op_1 ... op_n
+ *
+ * where every operation is
+ *
+ *   kind node wlen rlen wdata_1 ... wdata_wlen
+ *
+ * `kind` is one of I2CB_WRITE (wlen bytes), I2CB_READ (rlen bytes),
+ * I2CB_WRITE_READ (wlen bytes sent then rlen bytes received, as
+ * i2c_sandr()) or I2CB_PROBE. `node` is the 7 bit node address; bit 7
+ * set makes it urgent (see I2C_URGENT).
+ *
+ * Reply frame:
+ *
+ *   I2CB_SYNC n res_1 ... res_n
+ *
+ * where every result is a status byte (an i2c_status_t value or
+ * I2CB_REJECTED) followed, only if the operation receives data and
+ * status is Success, by its rlen bytes.
+ *
+ * A frame of more than I2CB_OPS operations is answered with an empty
+ * reply frame (n = 0) and its bytes are skipped until next sync byte.
+ * Operations whose data do not fit in the I2CB_BUF bytes left in the
+ * frame buffer, or of an unknown kind, are rejected.
+ */
+
+#include <stdint.h>
+#include "pt.h"
+
+
+/* frame sync byte */
+#define I2CB_SYNC 0xa5
+
+/* operation kinds */
+#define I2CB_WRITE      'W'
+#define I2CB_READ       'R'
+#define I2CB_WRITE_READ 'X'
+#define I2CB_PROBE      'P'
+
+/* max operations per frame */
+#define I2CB_OPS 8
+
+/* frame data buffer: bytes sent plus bytes received by its operations */
+#define I2CB_BUF 128
+
+/* status of an operation not run */
+#define I2CB_REJECTED 0xfe
+
+
+/*
+ * Bridge protothread. Must be scheduled periodically by the
+ * application. Serial port and i2c channel must be open.
+ */
+PT_THREAD(i2cb_run(struct pt *pt));
+
+
+#endif
@@ -0,0 +1,93 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include "pt.h"
+#include "i2c.h"
+#include "i2cdev.h"
+
+
+/*
+ * Note that the shadow copy is updated when a write is issued, not
+ * when it ends. If a write fails, the shadow copy no longer reflects
+ * the device. Registers should be reloaded with i2cdev_load() in
+ * this case.
+ */
+
+
+/* returns true iff register `reg` of `d` is uncacheable */
+static bool is_uncached(const i2cdev_t *const d, uint8_t reg) {
+  return d->uncached && (d->uncached[reg >> 3] & (1 << (reg & 07)));
+}
+
+
+void i2cdev_bind(i2cdev_t *const d,
+		 i2c_addr_t node,
+		 uint8_t *const shadow,
+		 uint8_t size,
+		 const uint8_t *const uncached) {
+  d->node = node;
+  d->shadow = shadow;
+  d->size = size;
+  d->uncached = uncached;
+}
+
+
+void i2cdev_load(i2cdev_t *const d,
+		 uint8_t first, uint8_t n,
+		 volatile i2c_status_t *const status) {
+  // a single request: the register pointer can not be moved between
+  d->reg = first;
+  i2c_sandr(d->node, &d->reg, 1, &d->shadow[first], n, status);
+}
+
+
+bool i2cdev_write(i2cdev_t *const d,
+		  uint8_t reg, uint8_t v,
+		  volatile i2c_status_t *const status) {
+  if (!is_uncached(d, reg) && d->shadow[reg] == v) {
+    // device already holds the value
+    if (status) *status = Success;
+    return false;
+  }
+  d->shadow[reg] = v;
+  i2c_send_2uint8(d->node, reg, v, status);
+  return true;
+}
+
+
+PT_THREAD(i2cdev_modify(struct pt *pt,
+			i2cdev_t *const d,
+			uint8_t reg, uint8_t mask, uint8_t bits,
+			i2c_status_t *const result))
+{
+  PT_BEGIN(pt);
+
+  if (is_uncached(d, reg)) {
+    // get current value from the device
+    d->reg = reg;
+    i2c_sandr(d->node, &d->reg, 1, &d->shadow[reg], 1, &d->st);
+    PT_WAIT_WHILE(pt, d->st == Running);
+    if (d->st != Success) {
+      *result = d->st;
+      PT_EXIT(pt);
+    }
+  }
+  i2cdev_write(d, reg, (d->shadow[reg] & ~mask) | (bits & mask), &d->st);
+  PT_WAIT_WHILE(pt, d->st == Running);
+  *result = d->st;
+
+  PT_END(pt);
+}
+
+
+void i2cdev_read(i2cdev_t *const d,
+		 uint8_t reg, uint8_t *const v,
+		 volatile i2c_status_t *const status) {
+  if (is_uncached(d, reg)) {
+    d->reg = reg;
+    i2c_sandr(d->node, &d->reg, 1, v, 1, status);
+  } else {
+    *v = d->shadow[reg];
+    if (status) *status = Success;
+  }
+}
@@ -0,0 +1,147 @@
+#ifndef _I2CDEV_H_
+#define _I2CDEV_H_
+
+/*
+ * Register based i2c devices with a shadow copy of their registers.
+ *
+ * Most i2c peripherals are configured through a set of 8 bit
+ * registers: a write sends the register address followed by the
+ * value, and a read sends the register address and then receives the
+ * value. This module keeps in RAM a shadow copy of the device
+ * registers, so that:
+ *
+ *  - writes that do not change a register value are skipped;
+ *  - read-modify-write operations become a single bus write;
+ *  - reads are served from the shadow copy.
+ *
+ * Registers that the device changes by itself (status, data, etc.)
+ * must be marked as uncacheable. Operations on them always go to the
+ * bus.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pt.h"
+#include "i2c.h"
+
+
+/* Bytes needed by the uncacheable registers map of `n` registers */
+#define I2CDEV_MAP_SIZE(n) (((n) + 7) / 8)
+
+
+/*
+ * A register based i2c device. Loads, uncacheable reads and
+ * modifications keep the register address in the device object until
+ * served: only one of them can be pending at a time on a device. Wait
+ * for its status (or its end) before the next one.
+ */
+typedef struct {
+  i2c_addr_t node;          /* device node address */
+  uint8_t *shadow;          /* shadow copy, indexed by register address */
+  const uint8_t *uncached;  /* uncacheable registers map (NULL if none) */
+  uint8_t size;             /* number of registers */
+  uint8_t reg;              /* register address being read */
+  volatile i2c_status_t st; /* current request status */
+} i2cdev_t;
+
+
+/**
+ * @brief Binds a device object to an i2c node.
+ *
+ * `shadow` must contain the current values of the device registers
+ * (usually their reset values), or it must be loaded with
+ * i2cdev_load() before using the device. Bit `r%8` of byte `r/8` in
+ * `uncached` is set iff register `r` is uncacheable.
+ *
+ * @param d:        The device object.
+ * @param node:     The device node address.
+ * @param shadow:   Array of `size` bytes holding the shadow copy.
+ * @param size:     The number of device registers.
+ * @param uncached: Map of ::I2CDEV_MAP_SIZE(size) bytes of uncacheable
+ *                  registers. NULL if all registers are cacheable.
+ */
+void i2cdev_bind(i2cdev_t *const d,
+		 i2c_addr_t node,
+		 uint8_t *const shadow,
+		 uint8_t size,
+		 const uint8_t *const uncached);
+
+/**
+ * @brief Loads `n` registers from `first` on into the shadow copy.
+ *
+ * Registers are read from the device in a single transaction (see
+ * i2c_sandr()), so no other request can move the device register
+ * pointer in between. Shadow values are undefined until `*status`
+ * becomes Success.
+ *
+ * @param d:      The device object.
+ * @param first:  First register address.
+ * @param n:      Number of consecutive registers to be read.
+ * @param status: The request status (see i2c_receive()).
+ * @pre first + n <= size
+ */
+void i2cdev_load(i2cdev_t *const d,
+		 uint8_t first, uint8_t n,
+		 volatile i2c_status_t *const status);
+
+/**
+ * @brief Writes `v` into register `reg`.
+ *
+ * If `reg` is cacheable and already holds `v`, nothing is sent and
+ * `*status` is set to Success.
+ *
+ * @param d:      The device object.
+ * @param reg:    Register address.
+ * @param v:      Value to be written.
+ * @param status: The request status (see i2c_send()).
+ * @returns true iff a bus write was issued.
+ */
+bool i2cdev_write(i2cdev_t *const d,
+		  uint8_t reg, uint8_t v,
+		  volatile i2c_status_t *const status);
+
+/**
+ * @brief Sets the bits selected by `mask` of register `reg` to
+ * those of `bits`.
+ *
+ * A protothread that ends when the register is modified or an error
+ * arises:
+ *
+ *   PT_SPAWN(pt, &child, i2cdev_modify(&child, &dev, reg, m, b, &st));
+ *
+ * A cacheable register is modified with a single bus write, if
+ * any. An uncacheable one needs to be read first, in a single
+ * transaction (see i2c_sandr()). The same device object cannot be
+ * used by two modifications at a time.
+ *
+ * @param pt:     The protothread context.
+ * @param d:      The device object.
+ * @param reg:    Register address.
+ * @param mask:   Bits to be modified.
+ * @param bits:   New values of the modified bits.
+ * @param result: Where the operation result is stored when it ends:
+ *                Success or the status of the failed request.
+ */
+PT_THREAD(i2cdev_modify(struct pt *pt,
+			i2cdev_t *const d,
+			uint8_t reg, uint8_t mask, uint8_t bits,
+			i2c_status_t *const result));
+
+/**
+ * @brief Reads register `reg` into `*v`.
+ *
+ * A cacheable register is read from the shadow copy and `*status` is
+ * set to Success. An uncacheable one is read from the device in a
+ * single transaction, as i2cdev_load().
+ *
+ * @param d:      The device object.
+ * @param reg:    Register address.
+ * @param v:      Where the register value will be stored.
+ * @param status: The request status (see i2c_receive()).
+ */
+void i2cdev_read(i2cdev_t *const d,
+		 uint8_t reg, uint8_t *const v,
+		 volatile i2c_status_t *const status);
+
+
+#endif
@@ -0,0 +1,81 @@
+#include <stdint.h>
+#include "pt.h"
+#include "i2c.h"
+#include "i2cee.h"
+
+
+void i2cee_bind(i2cee_t *const e, i2c_addr_t node, uint8_t page) {
+  e->node = node;
+  e->page = page;
+}
+
+
+PT_THREAD(i2cee_write(struct pt *pt,
+		      i2cee_t *const e,
+		      uint16_t addr,
+		      const uint8_t *const buffer,
+		      uint16_t n,
+		      i2c_status_t *const result))
+{
+  PT_BEGIN(pt);
+
+  e->addr = addr;
+  e->buf = buffer;
+  e->left = n;
+
+  while (e->left) {
+    /* a chunk never crosses a page boundary */
+    e->chunk = e->page - (e->addr & (e->page - 1));
+    if (e->chunk > e->left) e->chunk = e->left;
+
+    /* page write: memory address and then data, no copies */
+    e->hdr[0] = e->addr >> 8;
+    e->hdr[1] = e->addr & 0xff;
+    e->seg[0] = (i2c_seg_t){e->hdr, 2};
+    e->seg[1] = (i2c_seg_t){e->buf, e->chunk};
+    i2c_sendv(e->node, e->seg, 2, &e->st);
+    PT_WAIT_WHILE(pt, e->st == Running);
+    if (e->st != Success) {
+      *result = e->st;
+      PT_EXIT(pt);
+    }
+
+    /* ACK polling: device ignores its address while writing */
+    e->probes = 0;
+    do {
+      i2c_probe(e->node, &e->st);
+      PT_WAIT_WHILE(pt, e->st == Running);
+    } while (e->st == SlaveRejected && ++e->probes < I2CEE_MAX_PROBES);
+    if (e->st != Success) {
+      *result = e->st;
+      PT_EXIT(pt);
+    }
+
+    e->addr += e->chunk;
+    e->buf  += e->chunk;
+    e->left -= e->chunk;
+  }
+  *result = Success;
+
+  PT_END(pt);
+}
+
+
+PT_THREAD(i2cee_read(struct pt *pt,
+		     i2cee_t *const e,
+		     uint16_t addr,
+		     uint8_t *const buffer,
+		     uint16_t n,
+		     i2c_status_t *const result))
+{
+  PT_BEGIN(pt);
+
+  /* sequential read: set memory address and read the whole block */
+  e->hdr[0] = addr >> 8;
+  e->hdr[1] = addr & 0xff;
+  i2c_sandr(e->node, e->hdr, 2, buffer, n, &e->st);
+  PT_WAIT_WHILE(pt, e->st == Running);
+  *result = e->st;
+
+  PT_END(pt);
+}
@@ -0,0 +1,101 @@
+#ifndef _I2CEE_H_
+#define _I2CEE_H_
+
+/*
+ * Asyncronous driver for i2c serial EEPROMs of the 24xx family with
+ * 16 bit memory addresses (24LC256 and alike).
+ *
+ * Operations are protothreads to be spawned by the application
+ * threads:
+ *
+ *   PT_SPAWN(pt, &child, i2cee_write(&child, &ee, addr, buf, n, &st));
+ *
+ * Writes are split into page aligned chunks. After each chunk, the
+ * end of the device internal write cycle is detected by ACK polling:
+ * the device address is probed until the device acknowledges it. This
+ * is usually much shorter than the worst case write cycle time.
+ * Reads are done in a single sequential read transaction.
+ */
+
+#include <stdint.h>
+#include "pt.h"
+#include "i2c.h"
+
+
+/* page size of a 24LC256 */
+#define I2CEE_PAGE_24LC256 64
+
+/* max number of probes while waiting a write cycle to end */
+#define I2CEE_MAX_PROBES 200
+
+
+/* An EEPROM device. Fields are private */
+typedef struct {
+  i2c_addr_t node;
+  uint8_t page;                 // page size
+  uint16_t addr;                // next memory address
+  const uint8_t *buf;           // next byte to be written
+  uint16_t left;                // bytes left
+  uint8_t chunk;                // bytes in current chunk
+  uint8_t probes;               // probes done in current write cycle
+  uint8_t hdr[2];               // memory address bytes
+  i2c_seg_t seg[2];             // page write message
+  volatile i2c_status_t st;     // current request status
+} i2cee_t;
+
+
+/**
+ * @brief Binds an EEPROM object to an i2c node.
+ *
+ * @param e:    The EEPROM object.
+ * @param node: The device node address.
+ * @param page: The device page size in bytes (a power of 2).
+ */
+void i2cee_bind(i2cee_t *const e, i2c_addr_t node, uint8_t page);
+
+/**
+ * @brief Writes `n` bytes from `buffer` at EEPROM address `addr`.
+ *
+ * A protothread that ends when data is written or an error
+ * arises. `buffer` cannot be disposed until then. The same EEPROM
+ * object cannot be used by two operations at a time.
+ *
+ * @param pt:     The protothread context.
+ * @param e:      The EEPROM object.
+ * @param addr:   The EEPROM memory address.
+ * @param buffer: The data to be written.
+ * @param n:      The number of bytes to be written.
+ * @param result: Where the operation result is stored when it ends:
+ *                Success or the status of the failed request. If the
+ *                device does not end a write cycle in time, it is
+ *                SlaveRejected.
+ */
+PT_THREAD(i2cee_write(struct pt *pt,
+		      i2cee_t *const e,
+		      uint16_t addr,
+		      const uint8_t *const buffer,
+		      uint16_t n,
+		      i2c_status_t *const result));
+
+/**
+ * @brief Reads `n` bytes at EEPROM address `addr` into `buffer`.
+ *
+ * A protothread that ends when data is read or an error arises. The
+ * same EEPROM object cannot be used by two operations at a time.
+ *
+ * @param pt:     The protothread context.
+ * @param e:      The EEPROM object.
+ * @param addr:   The EEPROM memory address.
+ * @param buffer: Where the data read is stored.
+ * @param n:      The number of bytes to be read.
+ * @param result: Where the operation result is stored when it ends.
+ */
+PT_THREAD(i2cee_read(struct pt *pt,
+		     i2cee_t *const e,
+		     uint16_t addr,
+		     uint8_t *const buffer,
+		     uint16_t n,
+		     i2c_status_t *const result));
+
+
+#endif
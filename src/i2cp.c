@@ -0,0 +1,193 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <avr/io.h>
+#include <util/atomic.h>
+#include "timer.h"
+#include "i2c.h"
+#include "i2cp.h"
+
+
+/* scheduler period: 1 ms with a 250 kHz timer clock (CTC counts TOP+1) */
+#define TICK_FREQ  t250000
+#define TICK_COUNT UINT16_C(250-1)
+
+
+/**************************************************
+ * Private slot table
+ **************************************************/
+
+/* internal slot representation */
+typedef struct {
+  i2c_addr_t node;
+  uint8_t cmd[I2CP_CMD_L];
+  uint8_t cmd_length;
+  uint8_t length;
+  uint16_t period;
+  uint16_t countdown;              // ms to next sample
+  uint8_t buf[2][I2CP_SAMPLE_L];   // double buffer: `back` being received
+  volatile i2c_status_t st;        // status of the read in progress
+  i2c_status_t last;               // status of the last finished read
+  uint16_t skipped;
+  unsigned int used:1;             // 0 = slot not used
+  unsigned int busy:1;             // 1 = read in progress
+  unsigned int back:1;             // buffer being received
+  unsigned int fresh:1;            // 1 = sample not yet read
+} slot_t;
+
+/*
+ * Table of slots. Written by the timer ISR and by the main thread
+ * with interrupts disabled.
+ */
+static slot_t slots[I2CP_SLOTS];
+
+
+static void empty_table(void) {
+  for (uint8_t i = 0; i < I2CP_SLOTS; i++) {
+    slots[i].used = 0;
+    slots[i].busy = 0;
+  }
+}
+
+static int8_t get_free_slot(void) {
+  for (uint8_t i = 0; i < I2CP_SLOTS; ++i) {
+    if (!slots[i].used && !slots[i].busy) return i;
+  }
+  return I2CP_ERR;
+}
+
+
+
+/**************************************************
+ * Timer action: the scheduler
+ **************************************************/
+
+/* Submits a new read of slot `s` if possible */
+static void submit(slot_t *const s) {
+  // never block inside an ISR
+  if (s->busy || !i2c_room(s->node & I2C_URGENT(0))) {
+    s->skipped++;
+    return;
+  }
+  s->busy = 1;
+  if (s->cmd_length)
+    i2c_sandr(s->node, s->cmd, s->cmd_length,
+	      s->buf[s->back], s->length, &s->st);
+  else
+    i2c_receive(s->node, s->buf[s->back], s->length, &s->st);
+  if (s->st == Busy) {
+    // not queued: no room in its class
+    s->busy = 0;
+    s->skipped++;
+  }
+}
+
+
+/* Called every ms from the timer ISR */
+static void poll(void) {
+  for (uint8_t i = 0; i < I2CP_SLOTS; i++) {
+    slot_t *const s = &slots[i];
+
+    if (s->busy && s->st != Running) {
+      // last read finished: publish it if ok
+      s->busy = 0;
+      s->last = s->st;
+      if (s->st == Success) {
+	s->back ^= 1;
+	s->fresh = 1;
+      }
+    }
+    if (s->used && --s->countdown == 0) {
+      s->countdown = s->period;
+      submit(s);
+    }
+  }
+}
+
+
+
+/**************************************************
+ * Public operations
+ **************************************************/
+
+void i2cp_setup(void) {
+  empty_table();
+  timer_setup(TICK_FREQ);
+  timer_set_action(poll);
+}
+
+
+void i2cp_start(void) {
+  timer_arm_periodic(TICK_COUNT);
+}
+
+
+void i2cp_stop(void) {
+  timer_disarm();
+}
+
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wreturn-type"
+
+i2cp_slot_t i2cp_add(i2c_addr_t node,
+		     const uint8_t *const cmd, uint8_t cmd_length,
+		     uint8_t length,
+		     uint16_t period) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    const int8_t i = get_free_slot();
+    slot_t *s;
+
+    if (i == I2CP_ERR) return I2CP_ERR;
+    s = &slots[i];
+    s->node = node;
+    memcpy(s->cmd, cmd, cmd_length);
+    s->cmd_length = cmd_length;
+    s->length = length;
+    s->period = period;
+    // stagger slots to spread bus load
+    s->countdown = 1 + i;
+    s->last = Running;
+    s->skipped = 0;
+    s->back = 0;
+    s->fresh = 0;
+    s->used = 1;
+    return i;
+  }
+}
+
+
+bool i2cp_fresh(i2cp_slot_t s) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    return slots[s].fresh;
+  }
+}
+
+
+i2c_status_t i2cp_get(i2cp_slot_t s, uint8_t *const buffer) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    slot_t *const p = &slots[s];
+
+    // front buffer is the one not being received
+    memcpy(buffer, p->buf[!p->back], p->length);
+    p->fresh = 0;
+    return p->last;
+  }
+}
+
+
+uint16_t i2cp_skipped(i2cp_slot_t s) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    return slots[s].skipped;
+  }
+}
+
+#pragma GCC diagnostic pop
+
+
+void i2cp_remove(i2cp_slot_t s) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    // a read in progress keeps the slot busy until it ends
+    slots[s].used = 0;
+  }
+}
@@ -0,0 +1,101 @@
+#ifndef _I2CP_H_
+#define _I2CP_H_
+
+/*
+ * Periodic i2c polling scheduler
+ *
+ * A table of periodic read requests. Every slot of the table reads
+ * a message from a node at a fixed rate, optionally after sending it
+ * a short command (usually a register address). Requests are
+ * submitted from a timer interrupt, thus sampling times do not
+ * depend on the main loop scheduling.
+ *
+ * Results are double buffered: a new sample is received while the
+ * previous one can be read. A "fresh sample" flag tells whether a new
+ * sample arrived since the slot was last read.
+ *
+ * The module uses the timer module: they cannot be used separately
+ * in the same application.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "i2c.h"
+
+
+/* max number of slots */
+#define I2CP_SLOTS 4
+
+/* max length of a slot command */
+#define I2CP_CMD_L 2
+
+/* max length of a slot sample */
+#define I2CP_SAMPLE_L 8
+
+
+/* A slot handler. Negative if not valid */
+typedef int8_t i2cp_slot_t;
+
+/* Returned when no more slots are available */
+#define I2CP_ERR (-1)
+
+
+/* Setup the module. Sets up the timer module too */
+void i2cp_setup(void);
+
+/* Starts polling the slots. i2c must be open */
+void i2cp_start(void);
+
+/* Stops polling the slots. Requests already submitted go on */
+void i2cp_stop(void);
+
+
+/**
+ * @brief Adds a slot to the scheduler.
+ *
+ * Every `period` ms, the slot sends the `cmd_length` bytes in `cmd`
+ * to `node` and then receives a sample of `length` bytes. If
+ * `cmd_length` is 0 the sample is just received. `node` can be an
+ * urgent one (see ::I2C_URGENT).
+ *
+ * If a sample is due while the last one is still in progress or the
+ * i2c driver has no room for it, the sample is skipped.
+ *
+ * @param node:       Node to be polled.
+ * @param cmd:        Command to be sent before every read.
+ * @param cmd_length: Command length.
+ * @param length:     Sample length.
+ * @param period:     Polling period in ms.
+ * @pre cmd_length <= ::I2CP_CMD_L and 0 < length <= ::I2CP_SAMPLE_L
+ *      and period > 0
+ * @returns the new slot or ::I2CP_ERR if no more slots allowed.
+ */
+i2cp_slot_t i2cp_add(i2c_addr_t node,
+		     const uint8_t *const cmd, uint8_t cmd_length,
+		     uint8_t length,
+		     uint16_t period);
+
+/* Removes the slot `s` from the scheduler */
+void i2cp_remove(i2cp_slot_t s);
+
+/* Returns true iff a new sample arrived since last i2cp_get() */
+bool i2cp_fresh(i2cp_slot_t s);
+
+/**
+ * @brief Gets the last sample of slot `s`.
+ *
+ * Copies the last successfully received sample into `buffer` and
+ * clears the fresh sample flag.
+ *
+ * @param s:      The slot.
+ * @param buffer: Where the sample is copied. Must hold `length` bytes.
+ * @returns the status of the last finished read of the slot. If it is
+ *          not Success, the sample copied is the last good one.
+ */
+i2c_status_t i2cp_get(i2cp_slot_t s, uint8_t *const buffer);
+
+/* Returns the number of samples skipped by slot `s` */
+uint16_t i2cp_skipped(i2cp_slot_t s);
+
+
+#endif
@@ -1,59 +1,80 @@
 #include <inttypes.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include "i2cq.h"
 
 /*
- * We implement here a circular queue. `front` and `rear` are two
- * indexes pointing to the first element of the queue and to the first
- * empty cell respectively. Then the queue elements fill the cells
- * indexed by the interval [front,rear).
- *
- * There are two special states of the queue to consider:
- *  (a) The queue is empty. In this case front == rear
- *  (b) The queue is full. In this case last+1 (mod L) == rear
+ * We implement here a circular queue per priority class. Every class
+ * uses its own slice of the cells array: `len[p]` cells from `base[p]`
+ * on. `front` indexes the first element of the class queue (relative
+ * to its slice) and `n` is the number of elements. Then the queue
+ * elements fill the cells front, front+1, ... (mod len[p]).
  *
  * Queue is meant to be used exclusively in the i2c module. Therefore,
  * atomic sections correctness should be considered only for this
  * working context. **Other uses will require a review of them.**
  */
 
+static const uint8_t base[I2CQ_P] = {0, I2CQ_L0, I2CQ_L0 + I2CQ_L1};
+static const uint8_t len[I2CQ_P]  = {I2CQ_L0, I2CQ_L1, I2CQ_L2};
+
 
-static uint8_t inc(uint8_t v) {
-  return (++v == I2CQ_L) ? 0 : v;
+/* cell of element `i` of class `p` */
+static uint8_t cell(const i2cq_t *const q, uint8_t p, uint8_t i) {
+  i += q->c[p].front;
+  if (i >= len[p]) i -= len[p];
+  return base[p] + i;
 }
 
 void i2cq_empty(i2cq_t *const q) {
-  q->front = q->rear = 0;
+  for (uint8_t p = 0; p < I2CQ_P; p++)
+    q->c[p].front = q->c[p].n = 0;
 }
 
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wreturn-type"
-
 bool i2cq_is_empty(const i2cq_t *const q) {
-  return q->front == q->rear;
+  for (uint8_t p = 0; p < I2CQ_P; p++)
+    if (q->c[p].n) return false;
+  return true;
 }
 
-bool i2cq_is_full(const i2cq_t *const q) {
-  return inc(q->rear) == q->front;
+bool i2cq_is_empty_class(const i2cq_t *const q, uint8_t p) {
+  return q->c[p].n == 0;
+}
+
+bool i2cq_is_full(const i2cq_t *const q, uint8_t p) {
+  return q->c[p].n == len[p];
+}
+
+uint8_t i2cq_room(const i2cq_t *const q, uint8_t p) {
+  return len[p] - q->c[p].n;
 }
 
 
 const i2cr_request_t *i2cq_front(const i2cq_t *const q) {
-  return &(q->t[q->front]);
+  uint8_t p = 0;
+
+  // last class front is returned if all others are empty
+  while (p < I2CQ_P-1 && q->c[p].n == 0) p++;
+  return &q->t[cell(q, p, 0)];
 }
 
-#pragma GCC diagnostic pop
+i2cr_request_t *i2cq_rear(i2cq_t *const q, uint8_t p) {
+  if (q->c[p].n == 0) return NULL;
+  return &q->t[cell(q, p, q->c[p].n - 1)];
+}
 
 void i2cq_enqueue(i2cq_t *const q, const i2cr_request_t *const v) {
-  if (!i2cq_is_full(q)) {
-    q->t[q->rear] = *v;
-    q->rear = inc(q->rear);
+  const uint8_t p = v->prio;
+
+  if (!i2cq_is_full(q, p)) {
+    q->t[cell(q, p, q->c[p].n)] = *v;
+    q->c[p].n++;
   }
 }
 
-void i2cq_dequeue(i2cq_t *const q) {
-  if (!i2cq_is_empty(q)) {
-    q->front = inc(q->front);
+void i2cq_dequeue(i2cq_t *const q, uint8_t p) {
+  if (q->c[p].n) {
+    if (++q->c[p].front == len[p]) q->c[p].front = 0;
+    q->c[p].n--;
   }
 }
-
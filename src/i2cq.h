@@ -5,42 +5,68 @@
  * This module implements a syncronized queue of i2c requests.
  * This queues is to be used by the i2c low level driver.
  * Operations are guaranteed to be atomic.
+ *
+ * Requests are classified in priority classes. The queue front is
+ * always the front of the highest priority class that is not
+ * empty. Requests in the same class are kept in FIFO order.
  */
 
 #include <inttypes.h>
 #include <stdbool.h>
 #include "i2cr.h"
 
-/* the queue max length */
-#define I2CQ_L (10)
+/* number of priority classes. Class 0 is the highest priority one */
+#define I2CQ_P (3)
+
+/*
+ * Max length of every priority class. Requests are stored by copy
+ * (18 bytes each, 20 with I2C_STATS), so cells are given where they
+ * are needed: bus owner sequences are short and urgent requests are
+ * few. The whole queue takes 13 * 18 + 6 = 240 bytes.
+ */
+#define I2CQ_L0 (2)     /* bus owner requests */
+#define I2CQ_L1 (3)     /* urgent requests */
+#define I2CQ_L2 (8)     /* other requests */
 
+/* the queue cells, all classes */
+#define I2CQ_L (I2CQ_L0 + I2CQ_L1 + I2CQ_L2)
 
-/* the queue structure */
+
+/* the queue structure. Class `p` uses a slice of `t` */
 typedef struct {
   i2cr_request_t t[I2CQ_L];
-  uint8_t front, rear;
+  struct {
+    uint8_t front, n;
+  } c[I2CQ_P];
 } i2cq_t;
 
 
 /* Initializes `q` to empty  */
 void i2cq_empty(i2cq_t *const q);
 
-/* Returns true iff `q` is empty */
+/* Returns true iff `q` is empty (all classes are empty) */
 bool i2cq_is_empty(const i2cq_t *const q);
 
-/* Return true iff `q` is full */
-bool i2cq_is_full(const i2cq_t *const q);
+/* Returns true iff class `p` of `q` is empty */
+bool i2cq_is_empty_class(const i2cq_t *const q, uint8_t p);
+
+/* Return true iff class `p` of `q` is full */
+bool i2cq_is_full(const i2cq_t *const q, uint8_t p);
 
-/* Adds `v` to `q`. If `q` is full nothing is added */
+/* Returns the number of free cells of class `p` of `q` */
+uint8_t i2cq_room(const i2cq_t *const q, uint8_t p);
+
+/* Adds `v` to its class in `q`. If the class is full nothing is added */
 void i2cq_enqueue(i2cq_t *const q, const i2cr_request_t *const v);
 
-/* Remove the front element of `q`. 
- * If `q` is empty nothing is removed.
+/* Remove the front element of class `p` of `q`. 
+ * If the class is empty nothing is removed.
  */
-void i2cq_dequeue(i2cq_t *const q);
+void i2cq_dequeue(i2cq_t *const q, uint8_t p);
 
 /* 
- * Gets the front of `q`. 
+ * Gets the front of `q`: the front of its highest priority non
+ * empty class.
  *
  * @returns A pointer to the i2c request in the queue front. This object must
  *          be considered constant and must not be modified. 
@@ -48,5 +74,13 @@ void i2cq_dequeue(i2cq_t *const q);
  */
 const i2cr_request_t *i2cq_front(const i2cq_t *const q);
 
+/*
+ * Gets the rear (last enqueued) element of class `p` of `q`.
+ *
+ * @returns A pointer to the request, that can be modified while it
+ *          is not being served, or NULL if the class is empty.
+ */
+i2cr_request_t *i2cq_rear(i2cq_t *const q, uint8_t p);
+
 
 #endif
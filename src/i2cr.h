@@ -9,28 +9,53 @@
  */
 
 
+/* max bytes stored in a request (combined small writes) */
+#define I2CR_LOCAL_L 6
+
+
 /* The i2c request type */
 typedef enum {
   I2Csend, 
   I2Creceive, 
-  I2Csend_uint8,  // Single-byte send request type
-  I2Csend_2uint8, // Double-byte send request type
+  I2Csend_local,  // Send of bytes stored in the request
+  I2Csendv,       // Vectored (scatter-gather) send request type
+  I2Csandr,       // Send, RESTART and receive, in a single transaction
 } i2cr_type_t;
 
+/* SMBus PEC handling of a request */
+typedef enum {
+  PecNone,        // no PEC
+  PecAppend,      // send: append PEC byte
+  PecCheck,       // receive (or sandr): read and check PEC byte
+} i2cr_pec_t;
+
 /* 
  * An i2c request object. The form depends on the request type.
  */
 typedef struct {
   i2cr_type_t rt;
   i2c_addr_t node;
+  uint8_t prio;                     /* priority class (0 is the highest) */
+  i2cr_pec_t pec;                   /* PEC handling */
+  uint8_t route;                    /* 0, or (mux+1) << 3 | mux channel */
+  uint8_t retries;                  /* retries allowed if slave rejects */
+  uint8_t backoff;                  /* ticks to wait before a retry */
   volatile i2c_status_t *status;
+#ifdef I2C_STATS
+  uint16_t stamp;                   /* submission time */
+#endif
   union {
     /* buffer in user space */
-    struct {uint8_t *buffer; uint8_t length;} ue;
-    /* locally stored double byte */
-    uint8_t local_2byte[2];
-    /* locally stored single byte */
-    uint8_t local_byte;                           
+    struct {uint8_t *buffer; uint16_t length;} ue;
+    /* segments array in user space */
+    struct {const i2c_seg_t *seg; uint8_t n;} v;
+    /* send and receive buffers in user space */
+    struct {
+      const uint8_t *s; uint16_t s_length;
+      uint8_t *r; uint16_t r_length;
+    } sr;
+    /* locally stored bytes */
+    struct {uint8_t b[I2CR_LOCAL_L]; uint8_t n;} local;
   } data;
 } i2cr_request_t;
 
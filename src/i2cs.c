@@ -0,0 +1,178 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/twi.h>
+#include "i2cs.h"
+
+
+
+
+/************************
+ * Hw utility functions *
+ ************************/
+
+/**
+ * @brief Releases the bus after a slave event.
+ * The node remains addressable: next SLA+R/W or data byte matching
+ * this node will be acknowledged.
+ */
+static void throw_ack(void) {
+  TWCR = (1<<TWINT) |   // Clears previous interrupt flag
+         (1<<TWEA)  |   // ACK own address and data
+         (1<<TWEN)  |   // Enable TWI
+         (1<<TWIE);     // Enable I2C interrupts
+}
+
+
+/**
+ * @brief Recovers from an illegal START or STOP condition.
+ * Only internal hardware is affected; no STOP is sent to the bus.
+ */
+static void throw_recover(void) {
+  TWCR = (1<<TWINT) |   // Clears previous interrupt flag
+         (1<<TWSTO) |   // Release SDA and SCL lines
+         (1<<TWEA)  |   // ACK own address and data
+         (1<<TWEN)  |   // Enable TWI
+         (1<<TWIE);     // Enable I2C interrupts
+}
+
+
+
+/********************************************************
+ * Interrupt driven slave automata
+ ********************************************************/
+
+/* The register file being served */
+static volatile uint8_t *regs;
+static uint8_t size, writable;
+
+/* Action on write transfer end */
+static i2cs_action_t *action;
+
+/* Register pointer: next register to be read or written */
+static uint8_t ptr;
+
+/* First register and number of registers written in this transfer */
+static uint8_t first, written;
+
+/* Automata current state */
+static volatile enum {
+  Idle, SeekingPointer, RxData, TxData
+} isa_state;
+
+
+
+/**
+ * @brief Advances the register pointer wrapping around at window end.
+ */
+static void inc_ptr(void) {
+  if (++ptr == size) ptr = 0;
+}
+
+
+/**
+ * @brief Ends current transfer and notifies written registers if any.
+ */
+static void end_transfer(void) {
+  if (written && action) action(first, written);
+  written = 0;
+  isa_state = Idle;
+}
+
+
+/* interrupt service */
+ISR(TWI_vect) {
+  uint8_t b;
+
+  switch (TW_STATUS) {
+  case TW_SR_SLA_ACK:
+  case TW_SR_ARB_LOST_SLA_ACK:
+    /* Addressed to be written. First byte is the register pointer */
+    written = 0;
+    isa_state = SeekingPointer;
+    break;
+
+  case TW_SR_DATA_ACK:
+    b = TWDR;
+    if (isa_state == SeekingPointer) {
+      // Out of window pointers point to the first register
+      ptr = first = (b < size) ? b : 0;
+      isa_state = RxData;
+    } else {
+      if (ptr < writable) regs[ptr] = b;
+      written++;
+      inc_ptr();
+    }
+    break;
+
+  case TW_SR_STOP:
+    /* STOP or repeated START: the write transfer ended */
+    end_transfer();
+    break;
+
+  case TW_ST_SLA_ACK:
+  case TW_ST_ARB_LOST_SLA_ACK:
+    /* Addressed to be read. Maybe just after a write transfer */
+    isa_state = TxData;
+    // fall through
+  case TW_ST_DATA_ACK:
+    /* Master wants another byte */
+    TWDR = regs[ptr];
+    inc_ptr();
+    break;
+
+  case TW_ST_DATA_NACK:
+  case TW_ST_LAST_DATA:
+    /* Master does not want more data */
+    isa_state = Idle;
+    break;
+
+  case TW_BUS_ERROR:
+    end_transfer();
+    throw_recover();
+    return;
+
+  default:
+    /* General calls are not enabled: nothing else expected */
+    break;
+  }
+  throw_ack();
+}
+
+
+
+/*************************************************************
+ * Generic management operations
+ *************************************************************/
+
+void i2cs_setup(i2c_addr_t own) {
+  // Answer to `own` address. General call not recognized
+  TWAR = own << 1;
+  TWAMR = 0;
+}
+
+
+void i2cs_open(volatile uint8_t *const r,
+	       uint8_t s,
+	       uint8_t w,
+	       i2cs_action_t *const a) {
+  regs = r;
+  size = s;
+  writable = w;
+  action = a;
+  ptr = first = written = 0;
+  isa_state = Idle;
+  throw_ack();         // Enable I2C module and start answering
+}
+
+
+void i2cs_close(void) {
+  while (isa_state != Idle);          // Wait till transfer ends
+  TWCR = 0;                           // Disable I2C module
+}
+
+
+bool i2cs_busy(void) {
+  return isa_state != Idle;
+}
@@ -0,0 +1,84 @@
+#ifndef _I2CS_H_
+#define _I2CS_H_
+
+/*
+ * Low level driver for i2c bus slave access
+ *
+ * The node exposes a register file (a memory window owned by the
+ * application) to the bus masters. The register file is served from
+ * the TWI interrupt, thus response time does not depend on the main
+ * loop load. The protocol is the usual one of register based devices:
+ *
+ *  - A write transfer begins with a byte that sets the register
+ *    pointer. Next bytes are written to the register file at
+ *    auto-incremented addresses.
+ *  - A read transfer returns the register file contents from the
+ *    register pointer on, at auto-incremented addresses.
+ *
+ * The register pointer wraps around to 0 at the end of the
+ * window. Only the first `writable` registers of the window can be
+ * written by a master; writes to the remaining ones are acknowledged
+ * and silently ignored.
+ *
+ * This module and the i2c master module share the TWI hardware and
+ * its interrupt vector. They cannot be linked in the same application.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "i2c.h"
+
+
+/*
+ * Action called when a master finished a write transfer (a STOP or
+ * a repeated START is received). `first` is the register pointer
+ * value set by the transfer and `n` the number of registers written.
+ * Action is run in interrupt context: it must be short.
+ */
+typedef void i2cs_action_t(uint8_t first, uint8_t n);
+
+
+/**
+ * @brief I2C slave driver setup.
+ * Must be called before any other operation of the module.
+ *
+ * @param own: The I2C address the node will answer to.
+ */
+void i2cs_setup(i2c_addr_t own);
+
+/**
+ * @brief Opens the i2c slave channel.
+ * From now on, the node answers to the masters in the bus serving the
+ * register file `regs` of `size` bytes. Register file cannot be
+ * disposed until channel closed. Updates to multibyte values should
+ * be done with interrupts disabled to avoid a master reading a
+ * partially updated value.
+ *
+ * @param regs:     Pointer to the register file.
+ * @param size:     Size in bytes of the register file.
+ * @param writable: Number of registers, from the first one, that can
+ *                  be written by a master.
+ * @param a:        Action to be called on write transfer end. If NULL,
+ *                  no action is called.
+ * @pre size > 0 and writable <= size
+ */
+void i2cs_open(volatile uint8_t *const regs,
+	       uint8_t size,
+	       uint8_t writable,
+	       i2cs_action_t *const a);
+
+/**
+ * @brief Closes the i2c slave channel.
+ * The node stops answering to the bus masters.
+ */
+void i2cs_close(void);
+
+/**
+ * @brief Checks if a master is currently addressing this node.
+ *
+ * @returns true iff a transfer with this node is in progress.
+ */
+bool i2cs_busy(void);
+
+
+#endif
@@ -0,0 +1,325 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <avr/io.h>
+#include <util/delay.h>
+#include "pt.h"
+#include "i2c.h"
+#include "lcd.h"
+
+
+/* backpack port bits */
+#define BP_RS _BV(0)     // register select: 1 = data
+#define BP_EN _BV(2)     // enable: data latched on falling edge
+#define BP_BL _BV(3)     // backlight
+
+/* HD44780 commands and flags */
+#define CMD_CLEAR        0x01
+#define CMD_ENTRY        0x04
+#define   ENTRY_INC      0x02
+#define   ENTRY_SHIFT    0x01
+#define CMD_DISPLAY      0x08
+#define   DISPLAY_ON     0x04
+#define CMD_FUNCTION     0x20
+#define   FUNCTION_2LINE 0x08
+#define CMD_CGRAM        0x40
+#define CMD_DDRAM        0x80
+
+/* controller address counter unknown */
+#define NO_ADDRESS 0xff
+
+/* unchanged cells bridged inside a run: cheaper than a new burst */
+#define RUN_GAP 2
+
+/* bytes sent to the backpack per controller byte (two nibbles) */
+#define PACKED_L 4
+
+/* a burst: address command and a whole row */
+#define BURST_L (PACKED_L * (1 + LCD_MAX_COLS))
+
+/* a custom char definition: address command and 8 rows */
+#define CMDBUF_L (PACKED_L * (1 + 8))
+
+
+/**************************************************
+ * Private display table and its operations
+ **************************************************/
+
+/* internal display representation */
+typedef struct {
+  i2c_addr_t node;
+  uint8_t cols, rows;
+  uint8_t bl;                   // backlight bit
+  uint8_t entry;                // entry mode flags
+  uint8_t cursor;               // framebuffer write cursor
+  uint8_t address;              // controller DDRAM address counter
+  uint8_t scan;                 // next cell to be scanned by refresh
+  uint8_t first, last;          // cells sent in current burst
+  uint8_t n;                    // current burst length
+  volatile bool dirty;          // framebuffer changed since last scan
+  bool used;
+  uint8_t fb[LCD_MAX_ROWS * LCD_MAX_COLS];     // framebuffer
+  uint8_t shown[LCD_MAX_ROWS * LCD_MAX_COLS];  // cells on display
+  uint8_t burst[BURST_L];       // refresh burst
+  uint8_t cmd[CMDBUF_L];        // command message
+  volatile i2c_status_t st;     // refresh burst status
+} lcd_d;
+
+/* table of displays */
+static lcd_d lcds[LCD_MAX];
+
+
+static int8_t get_free_slot(void) {
+  for (uint8_t i = 0; i < LCD_MAX; ++i) {
+    if (!lcds[i].used) return i;
+  }
+  return -1;
+}
+
+
+/* DDRAM address of framebuffer cell `i` */
+static uint8_t ddram(const lcd_d *const d, uint8_t i) {
+  const uint8_t row = i / d->cols;
+  const uint8_t col = i % d->cols;
+
+  /* rows 2 and 3 continue rows 0 and 1 */
+  return ((row & 1) ? 0x40 : 0) + ((row & 2) ? d->cols : 0) + col;
+}
+
+
+/* packs byte `b` into `p` as two clocked nibbles. Returns bytes packed */
+static uint8_t pack(uint8_t *const p, const lcd_d *const d,
+		    uint8_t b, uint8_t rs) {
+  const uint8_t hi = (b & 0xf0) | rs | d->bl;
+  const uint8_t lo = (b << 4)   | rs | d->bl;
+
+  p[0] = hi | BP_EN;
+  p[1] = hi;
+  p[2] = lo | BP_EN;
+  p[3] = lo;
+  return PACKED_L;
+}
+
+
+/* sends the first `n` bytes of the command buffer and waits */
+static void send_cmdbuf(lcd_d *const d, uint8_t n) {
+  volatile i2c_status_t st;
+
+  i2c_send(d->node, d->cmd, n, &st);
+  while (st == Running);
+  // address counter changed or unknown
+  d->address = NO_ADDRESS;
+}
+
+
+/* sends a command to the controller */
+static void command(lcd_d *const d, uint8_t c) {
+  send_cmdbuf(d, pack(d->cmd, d, c, 0));
+}
+
+
+/* sends a single nibble (only used in initialization) */
+static void nibble(lcd_d *const d, uint8_t v) {
+  d->cmd[0] = (v << 4) | d->bl | BP_EN;
+  d->cmd[1] = (v << 4) | d->bl;
+  send_cmdbuf(d, 2);
+}
+
+
+/* writes a character into the framebuffer */
+static void put(lcd_d *const d, uint8_t c) {
+  d->fb[d->cursor] = c;
+  if (++d->cursor == d->cols * d->rows) d->cursor = 0;
+  d->dirty = true;
+}
+
+
+
+/**************************************************
+ * Public operations
+ **************************************************/
+
+lcd_t lcd_bind(i2c_addr_t node, uint8_t cols, uint8_t rows) {
+  const int8_t i = get_free_slot();
+  lcd_d *d;
+
+  if (i < 0) return LCD_ERR;
+  d = &lcds[i];
+  d->used = true;
+  d->node = node;
+  d->cols = cols;
+  d->rows = rows;
+  d->bl = BP_BL;
+  d->entry = 0;
+  d->cursor = 0;
+  d->address = NO_ADDRESS;
+  d->dirty = false;
+  memset(d->fb, ' ', sizeof(d->fb));
+  memset(d->shown, ' ', sizeof(d->shown));
+  return d;
+}
+
+
+void lcd_unbind(lcd_t l) {
+  ((lcd_d *)l)->used = false;
+}
+
+
+void lcd_on(lcd_t l) {
+  lcd_d *const d = l;
+
+  /* power on wait and 4 bit mode initialization (HD44780 fig. 24) */
+  _delay_ms(50);
+  nibble(d, 0x3);
+  _delay_ms(5);
+  nibble(d, 0x3);
+  _delay_us(150);
+  nibble(d, 0x3);
+  nibble(d, 0x2);
+
+  command(d, CMD_FUNCTION | FUNCTION_2LINE);
+  command(d, CMD_DISPLAY  | DISPLAY_ON);
+  command(d, CMD_CLEAR);
+  _delay_ms(2);
+  command(d, CMD_ENTRY | ENTRY_INC | d->entry);
+
+  /* display is blank: framebuffer must be sent again */
+  memset(d->shown, ' ', sizeof(d->shown));
+  d->dirty = true;
+}
+
+
+void lcd_off(lcd_t l) {
+  command(l, CMD_DISPLAY);
+}
+
+
+void lcd_backlight(lcd_t l, bool on) {
+  lcd_d *const d = l;
+
+  d->bl = on ? BP_BL : 0;
+  d->cmd[0] = d->bl;
+  send_cmdbuf(d, 1);
+}
+
+
+void lcd_enable_autoscroll(lcd_t l) {
+  lcd_d *const d = l;
+
+  d->entry = ENTRY_SHIFT;
+  command(d, CMD_ENTRY | ENTRY_INC | d->entry);
+}
+
+
+void lcd_disable_autoscroll(lcd_t l) {
+  lcd_d *const d = l;
+
+  d->entry = 0;
+  command(d, CMD_ENTRY | ENTRY_INC | d->entry);
+}
+
+
+void lcd_create_char(lcd_t l, uint8_t n, const uint8_t map[8]) {
+  lcd_d *const d = l;
+  uint8_t k;
+
+  /* address and rows in a single burst */
+  k = pack(d->cmd, d, CMD_CGRAM | (n & 07) << 3, 0);
+  for (uint8_t i = 0; i < 8; i++)
+    k += pack(&d->cmd[k], d, map[i], BP_RS);
+  send_cmdbuf(d, k);
+}
+
+
+void lcd_clear(lcd_t l) {
+  lcd_d *const d = l;
+
+  memset(d->fb, ' ', d->cols * d->rows);
+  d->cursor = 0;
+  d->dirty = true;
+}
+
+
+void lcd_move_cursor(lcd_t l, uint8_t col, uint8_t row) {
+  lcd_d *const d = l;
+
+  d->cursor = row * d->cols + col;
+}
+
+
+void lcd_print(lcd_t l, const char *s) {
+  while (*s) put(l, *s++);
+}
+
+
+void lcd_send(lcd_t l, lcd_mode_t m, uint8_t b) {
+  if (m == LCD_DATA)
+    put(l, b);
+  else
+    command(l, b);
+}
+
+
+
+/**************************************************
+ * Refresh
+ **************************************************/
+
+/*
+ * Builds the burst for the next run of changed cells from `scan` on.
+ * A run never crosses a row and bridges short gaps of unchanged
+ * cells. Returns false iff no changed cells left.
+ */
+static bool next_run(lcd_d *const d) {
+  const uint8_t size = d->cols * d->rows;
+  uint8_t i = d->scan;
+  uint8_t row_end;
+
+  while (i < size && d->fb[i] == d->shown[i]) i++;
+  if (i == size) return false;
+
+  /* extend run */
+  row_end = (i / d->cols + 1) * d->cols;
+  d->first = d->last = i;
+  for (uint8_t j = i + 1; j < row_end && j <= d->last + RUN_GAP + 1; j++)
+    if (d->fb[j] != d->shown[j]) d->last = j;
+
+  /* set address only if controller is not already there */
+  d->n = 0;
+  if (d->address != ddram(d, d->first))
+    d->n += pack(d->burst, d, CMD_DDRAM | ddram(d, d->first), 0);
+  for (uint8_t j = d->first; j <= d->last; j++) {
+    d->shown[j] = d->fb[j];
+    d->n += pack(&d->burst[d->n], d, d->fb[j], BP_RS);
+  }
+  d->address = ddram(d, d->last) + 1;
+  d->scan = d->last + 1;
+  return true;
+}
+
+
+PT_THREAD(lcd_refresh(struct pt *pt, lcd_t l))
+{
+  lcd_d *const d = l;
+
+  PT_BEGIN(pt);
+
+  for (;;) {
+    PT_WAIT_UNTIL(pt, d->dirty);
+    d->dirty = false;
+    d->scan = 0;
+    while (next_run(d)) {
+      i2c_send(d->node, d->burst, d->n, &d->st);
+      PT_WAIT_WHILE(pt, d->st == Running);
+      if (d->st != Success) {
+	/* force to send these cells again */
+	for (uint8_t j = d->first; j <= d->last; j++)
+	  d->shown[j] = ~d->fb[j];
+	d->address = NO_ADDRESS;
+	d->dirty = true;
+      }
+    }
+  }
+
+  PT_END(pt);
+}
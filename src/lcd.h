@@ -0,0 +1,107 @@
+#ifndef _LCD_H_
+#define _LCD_H_
+
+/*
+ * lcd - HD44780 character displays behind a PCF8574 i2c backpack
+ *
+ * Characteristics:
+ * (1) The application writes into a RAM framebuffer. Writes are
+ *     immediate and never touch the bus.
+ * (2) A background protothread, lcd_refresh(), sends to the display
+ *     only the cells that changed since the last refresh. Runs of
+ *     changed cells are sent in a single i2c burst.
+ * (3) The display is driven in 4 bit mode: every byte is sent to the
+ *     controller as two nibbles, each one clocked by an enable pulse,
+ *     that is, 4 backpack bytes.
+ *
+ * Backpack wiring assumed: P0=RS, P1=RW, P2=EN, P3=backlight, P4..P7=D4..D7
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include "pt.h"
+#include "i2c.h"
+
+
+/* max number of displays */
+#define LCD_MAX 1
+
+/* max display geometry */
+#define LCD_MAX_COLS 20
+#define LCD_MAX_ROWS 4
+
+
+/* `lcd_t` is a handler to an internal display */
+typedef void* lcd_t;
+
+/* Some functions can return error */
+#define LCD_ERR NULL
+
+/* Kind of byte sent to the controller by lcd_send() */
+typedef enum {LCD_CMD=0, LCD_DATA=1} lcd_mode_t;
+
+
+/*
+ * Binds a display object to the backpack at `node`.
+ * Returns `LCD_ERR` if no more displays allowed.
+ */
+lcd_t lcd_bind(i2c_addr_t node, uint8_t cols, uint8_t rows);
+
+/* Unbinds a display object */
+void lcd_unbind(lcd_t l);
+
+/*
+ * Initializes the controller and switches the display on. Blocks
+ * around 60 ms. i2c must be open.
+ */
+void lcd_on(lcd_t l);
+
+/* Switches the display off. Framebuffer contents are kept */
+void lcd_off(lcd_t l);
+
+/* Switches the backlight on or off */
+void lcd_backlight(lcd_t l, bool on);
+
+/* Autoscroll on/off. Framebuffer cells are only meaningful if off */
+void lcd_enable_autoscroll(lcd_t l);
+void lcd_disable_autoscroll(lcd_t l);
+
+/*
+ * Defines the custom character `n` (0..7) with the 8 rows of 5 bit
+ * pixels in `map`. It is shown writing the character code `n`.
+ */
+void lcd_create_char(lcd_t l, uint8_t n, const uint8_t map[8]);
+
+
+/*
+ * Framebuffer operations.
+ * Writes go to the framebuffer at the write cursor, that advances
+ * after every character and wraps around to next row.
+ */
+
+/* Fills the framebuffer with blanks and moves cursor home */
+void lcd_clear(lcd_t l);
+
+/* Moves the write cursor to column `col` of row `row` (0 based) */
+void lcd_move_cursor(lcd_t l, uint8_t col, uint8_t row);
+
+/* Writes the string `s` */
+void lcd_print(lcd_t l, const char *s);
+
+/*
+ * Sends a byte. LCD_DATA bytes are written to the framebuffer as
+ * characters. LCD_CMD bytes are sent immediately to the controller.
+ */
+void lcd_send(lcd_t l, lcd_mode_t m, uint8_t b);
+
+
+/*
+ * Refresh protothread. Sends framebuffer changes to the display.
+ * Must be scheduled periodically by the application. It waits
+ * while there are no changes.
+ */
+PT_THREAD(lcd_refresh(struct pt *pt, lcd_t l));
+
+
+#endif
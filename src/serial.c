@@ -46,6 +46,8 @@ ISR(USART_UDRE_vect) {
   } else {
     UDR0 = queue_front(&outq);
     queue_dequeue(&outq);
+    // a frame is pending: clear TXC0 (written 1) until it is shifted out
+    UCSR0A = (UCSR0A & (_BV(U2X0) | _BV(MPCM0))) | _BV(TXC0);
   }
 }
 #endif
@@ -40,6 +40,22 @@ uint16_t ticker_get(void) {
   }
 }
 
+uint16_t ticker_get_fine(void) {
+  /* Do not force interrupts on: it is also used from ISR's */
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    uint16_t t = ticks;
+    uint8_t c = TCNT2;
+
+    /* a compare match is pending. If counter already restarted, the
+     * tick is not yet accounted in `ticks` */
+    if (TIFR2 & _BV(OCF2A)) {
+      c = TCNT2;
+      if (c != OCR2A) t++;
+    }
+    return t * (OCR2A + 1) + c;
+  }
+}
+
 #pragma GCC diagnostic pop
 
 
@@ -22,6 +22,12 @@ void ticker_start(void);
  */
 uint16_t ticker_get(void);
 
+/* Get current ticker value with sub-tick resolution, in units of
+ * ticker timer counts (64 us). Overflows freely, every ~4.2 s.
+ * Only called if ticker started. Can be called from an ISR.
+ */
+uint16_t ticker_get_fine(void);
+
 /* Get ticker beat in ticks per second */
 inline uint16_t ticker_tps(void) {
   return 16000000/1024/156;
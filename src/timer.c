@@ -7,6 +7,9 @@
 
 static timer_action_t *action;
 
+/* true iff armed in periodic mode */
+static volatile bool periodic;
+
 
 
 void timer_setup(timer_freq_t s) {
@@ -24,9 +27,16 @@ void timer_setup(timer_freq_t s) {
 extern void timer_arm_once(uint16_t c);
 
 
+void timer_arm_periodic(uint16_t c) {
+  periodic = true;
+  timer_arm_once(c);
+}
+
+
 extern void timer_disarm(void) {
   // Disable interrupts
   TIMSK1 = 0;
+  periodic = false;
 }
 
 
@@ -43,7 +53,9 @@ void timer_set_action(timer_action_t *const a) {
  *****************************************************************/
 
 ISR(TIMER1_COMPA_vect) {
-  timer_disarm(); /* only one action done */
+  /* in CTC mode counter already restarted: keep interrupts enabled
+   * to fire again if periodic */
+  if (!periodic) timer_disarm(); /* only one action done */
   action();
 }
 
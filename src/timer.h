@@ -9,6 +9,8 @@
  *  -  If we call `timer_arm_once(c)`, action will be 
  *     called a single time after `c` clock pulses. Timer will be
  *     automatically disarmed after this cycle.
+ *  -  If we call `timer_arm_periodic(c)`, action will be called
+ *     every `c` clock pulses until the timer is disarmed.
  */
 
 #include <stdbool.h>
@@ -40,6 +42,12 @@ inline void timer_arm_once(uint16_t c) {
 }
 
 
+/* arm the timer to fire action every `c` counts. The period is
+ * exact: it does not depend on the action execution time.
+ * Disarm it before arming it once. */
+void timer_arm_periodic(uint16_t c);
+
+
 /* disarm the timer */
 void timer_disarm(void);
 
@@ -0,0 +1,113 @@
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include "i2c.h"
+
+/*
+ * i2c driver benchmark firmware. To be run in the simulation harness
+ * (sim/sim_i2c), with the models attached at these addresses:
+ *
+ *   sim_i2c bench_i2c reg:0x20 eeprom:0x50 nack:0x30 stretch:0x40:40
+ *
+ * Every workload is a phase. Phase number is written to PORTB when
+ * the phase begins; 0 means benchmark ended. Requests are submitted
+ * back to back to keep the driver queue full.
+ */
+
+#define REG_ADDRESS     (0x20)
+#define NACK_ADDRESS    (0x30)
+#define STRETCH_ADDRESS (0x40)
+#define EE_ADDRESS      (0x50)
+
+#define N   200   // transactions per phase
+#define LEN 16    // bytes per transaction
+
+
+static uint8_t buf[LEN];
+static uint8_t hdr[2];
+static i2c_seg_t page[2] = {{hdr, 2}, {buf, LEN}};
+static volatile i2c_status_t st[N];      // every request of a phase
+static volatile i2c_status_t wst, pst;   // EEPROM write and its probes
+
+
+static void phase(uint8_t p) {
+  PORTB = p;
+}
+
+/* waits for every request of the phase to end. Each one has its own
+ * status: a shared one would end the phase at the first completion,
+ * with a queue of requests still to be served */
+static void wait_all(void) {
+  for (uint16_t i = 0; i < N; i++)
+    while (st[i] == Running);
+}
+
+
+int main(void) {
+  DDRB = 0xff;
+  phase(0xff);
+  
+  i2c_setup();
+  sei();
+  i2c_open();
+
+  /* 1: block sends */
+  phase(1);
+  for (uint16_t i = 0; i < N; i++)
+    i2c_send(REG_ADDRESS, buf, LEN, &st[i]);
+  wait_all();
+
+  /* 2: block receives */
+  phase(2);
+  for (uint16_t i = 0; i < N; i++)
+    i2c_receive(REG_ADDRESS, buf, LEN, &st[i]);
+  wait_all();
+
+  /* 3: single byte sends */
+  phase(3);
+  for (uint16_t i = 0; i < N; i++)
+    i2c_send_2uint8(REG_ADDRESS, 0x01, i, &st[i]);
+  wait_all();
+
+  /* 4: register reads (send and receive) */
+  phase(4);
+  for (uint16_t i = 0; i < N; i++)
+    i2c_sandr(REG_ADDRESS, hdr, 1, buf, 2, &st[i]);
+  wait_all();
+
+  /* 5: EEPROM page writes, ACK polling each write cycle. Polling
+   * begins when the write ends: the write cycle begins at its STOP */
+  phase(5);
+  for (uint16_t i = 0; i < N/10; i++) {
+    hdr[0] = 0; hdr[1] = (i * LEN) & 0xff;
+    i2c_sendv(EE_ADDRESS, page, 2, &wst);
+    while (wst == Running);
+    do {
+      i2c_probe(EE_ADDRESS, &pst);
+      while (pst == Running);
+    } while (pst == SlaveRejected);
+  }
+
+  /* 6: rejected requests */
+  phase(6);
+  for (uint16_t i = 0; i < N; i++)
+    i2c_probe(NACK_ADDRESS, &st[i]);
+  wait_all();
+
+  /* 7: block sends to a clock stretching device */
+  phase(7);
+  for (uint16_t i = 0; i < N; i++)
+    i2c_send(STRETCH_ADDRESS, buf, LEN, &st[i]);
+  wait_all();
+
+  phase(0);
+  i2c_close();
+
+  /* sleeping with interrupts disabled ends the simulation */
+  cli();
+  sleep_enable();
+  sleep_cpu();
+
+  return 0;
+}
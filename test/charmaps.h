@@ -0,0 +1,41 @@
+#ifndef _CHARMAPS_H_
+#define _CHARMAPS_H_
+
+#include <stdint.h>
+
+/* Custom characters for test_lcd: 5x8 pixel rows, top to bottom */
+
+static const uint8_t U_char[8] = {
+  0b10001,
+  0b10001,
+  0b10001,
+  0b10001,
+  0b10001,
+  0b10001,
+  0b01110,
+  0b00000,
+};
+
+static const uint8_t P_char[8] = {
+  0b11110,
+  0b10001,
+  0b10001,
+  0b11110,
+  0b10000,
+  0b10000,
+  0b10000,
+  0b00000,
+};
+
+static const uint8_t C_char[8] = {
+  0b01110,
+  0b10001,
+  0b10000,
+  0b10000,
+  0b10000,
+  0b10001,
+  0b01110,
+  0b00000,
+};
+
+#endif
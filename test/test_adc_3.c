@@ -0,0 +1,70 @@
+#include <stdint.h>
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include "pt.h"
+#include "pt-delay.h"
+#include "ticker.h"
+#include "serial.h"
+#include "test_fixture.h"
+#include "adc.h"
+
+/*
+ * Scans the potentiometer (10 bits) and the internal 0V channel
+ * (8 bits) in background. Every 0.5 s prints their last values and
+ * how many new values arrived meanwhile.
+ */
+
+#define N_CH 2
+
+
+PT_THREAD(report(struct pt *pt))
+{
+  static uint8_t last[N_CH];
+  static uint8_t i;
+  static uint16_t v;
+  static uint8_t s;
+
+  PT_BEGIN(pt);
+
+  for(;;) {
+    PT_DELAY(pt, 50);
+    for (i = 0; i < N_CH; i++) {
+      v = adc_scan_get(i, &s);
+      PT_WAIT_UNTIL(pt, serial_can_write());
+      serial_write_ui(v);
+      PT_WAIT_UNTIL(pt, serial_can_write());
+      serial_write(' ');
+      PT_WAIT_UNTIL(pt, serial_can_write());
+      serial_write_ui((uint8_t)(s - last[i]));
+      PT_WAIT_UNTIL(pt, serial_can_write());
+      serial_write(' ');
+      last[i] = s;
+    }
+    PT_WAIT_UNTIL(pt, serial_can_write());
+    serial_eol();
+  }
+
+  PT_END(pt);
+}
+
+
+int main(void) {
+  struct pt report_ctx;
+  adc_channel chs[N_CH];
+
+  ticker_setup();
+  ticker_start();
+  serial_setup();
+  adc_setup();
+  sei();
+  serial_open();
+
+  chs[0] = adc_bind(POT_CHANNEL | ADC_10BIT, POT_REFERENCE);
+  chs[1] = adc_bind(ADC_CHANNEL_0V, POT_REFERENCE);
+  adc_scan_start(chs, N_CH);
+
+  PT_INIT(&report_ctx);
+  for(;;) {
+    (void)PT_SCHEDULE(report(&report_ctx));
+  }
+}
@@ -0,0 +1,62 @@
+#include <stdint.h>
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include "pt.h"
+#include "ticker.h"
+#include "serial.h"
+#include "test_fixture.h"
+#include "adc.h"
+
+/*
+ * Samples the potentiometer (10 bits) at 1 kS/s. Every 500 samples
+ * prints their mean and the samples lost so far.
+ */
+
+#define RATE 1000
+#define BLOCK 500
+
+
+PT_THREAD(average(struct pt *pt))
+{
+  static uint32_t sum;
+  static uint16_t n;
+
+  PT_BEGIN(pt);
+
+  for(;;) {
+    sum = 0;
+    for (n = 0; n < BLOCK; n++) {
+      PT_WAIT_UNTIL(pt, adc_stream_available());
+      sum += adc_stream_get();
+    }
+    PT_WAIT_UNTIL(pt, serial_can_write());
+    serial_write_ui(sum / BLOCK);
+    PT_WAIT_UNTIL(pt, serial_can_write());
+    serial_write(' ');
+    PT_WAIT_UNTIL(pt, serial_can_write());
+    serial_write_ui(adc_stream_overruns());
+    PT_WAIT_UNTIL(pt, serial_can_write());
+    serial_eol();
+  }
+
+  PT_END(pt);
+}
+
+
+int main(void) {
+  struct pt average_ctx;
+
+  ticker_setup();
+  ticker_start();
+  serial_setup();
+  adc_setup();
+  sei();
+  serial_open();
+
+  adc_stream_start(adc_bind(POT_CHANNEL | ADC_10BIT, POT_REFERENCE), RATE);
+
+  PT_INIT(&average_ctx);
+  for(;;) {
+    (void)PT_SCHEDULE(average(&average_ctx));
+  }
+}
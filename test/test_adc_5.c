@@ -0,0 +1,71 @@
+#include <stdint.h>
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include "pt.h"
+#include "pt-delay.h"
+#include "ticker.h"
+#include "serial.h"
+#include "test_fixture.h"
+#include "adc.h"
+
+/*
+ * Calibrates Vcc once, waiting, and then every second in background.
+ * Right after requesting each calibration the potentiometer (10 bits)
+ * is read with a polled and a sleeping conversion: they wait for the
+ * calibration to end. Prints Vcc and both readings in millivolts.
+ */
+
+
+static adc_channel pot;
+
+
+static void put(uint16_t v) {
+  while (!serial_can_write());
+  serial_write_ui(v);
+  while (!serial_can_write());
+  serial_write(' ');
+}
+
+
+PT_THREAD(report(struct pt *pt))
+{
+  static uint16_t polled, slept;
+
+  PT_BEGIN(pt);
+
+  for(;;) {
+    PT_DELAY(pt, 100);
+    (void)adc_adjust_start();
+    polled = adc_prep_start_get16(pot);
+    slept = adc_prep_sleep_get16(pot);
+    put(adc_vcc());
+    put(adc_to_mv16(polled));
+    put(adc_to_mv16(slept));
+    while (!serial_can_write());
+    serial_eol();
+  }
+
+  PT_END(pt);
+}
+
+
+int main(void) {
+  struct pt report_ctx;
+
+  ticker_setup();
+  ticker_start();
+  serial_setup();
+  adc_setup();
+  sei();
+  serial_open();
+
+  pot = adc_bind(POT_CHANNEL | ADC_10BIT, POT_REFERENCE);
+  put(adc_adjust());
+  while (!serial_can_write());
+  serial_eol();
+
+  PT_INIT(&report_ctx);
+  for(;;) {
+    (void)PT_SCHEDULE(report(&report_ctx));
+  }
+}
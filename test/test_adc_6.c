@@ -0,0 +1,72 @@
+#include <stdint.h>
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <util/delay.h>
+#include "serial.h"
+#include "test_fixture.h"
+#include "adc.h"
+
+/*
+ * Compares the noise of polled and sleeping conversions of the
+ * potentiometer (10 bits). Every second takes N samples each way and
+ * prints their minimum, maximum and mean.
+ *
+ * Noise reduction mode is only used while the I/O clock is not needed:
+ * the ticker is not started and the serial port is closed while
+ * sampling. Every 8th pass the port is left open, so sleeping
+ * conversions only idle the CPU, for reference.
+ */
+
+#define N 256
+
+typedef struct {
+  uint16_t min, max;
+  uint32_t sum;
+} stats_t;
+
+
+static void account(stats_t *const s, uint16_t v) {
+  if (v < s->min) s->min = v;
+  if (v > s->max) s->max = v;
+  s->sum += v;
+}
+
+
+static void put(char *what, const stats_t *const s) {
+  serial_write_s(what);
+  serial_write_ui(s->min);
+  serial_write(' ');
+  serial_write_ui(s->max);
+  serial_write(' ');
+  serial_write_ui(s->sum / N);
+}
+
+
+int main(void) {
+  adc_channel pot;
+
+  serial_setup();
+  adc_setup();
+  sei();
+  pot = adc_bind(POT_CHANNEL | ADC_10BIT, POT_REFERENCE);
+
+  serial_open();
+  serial_write_s("== begin test\n");
+
+  for (uint8_t pass = 0; ; pass++) {
+    stats_t polled = {UINT16_MAX, 0, 0}, slept = {UINT16_MAX, 0, 0};
+    const bool open = (pass & 07) == 07;
+
+    if (!open) serial_close();
+    for (uint16_t i = 0; i < N; i++) {
+      account(&polled, adc_prep_start_get16(pot));
+      account(&slept, adc_prep_sleep_get16(pot));
+    }
+    if (!open) serial_open();
+
+    put(open ? "(port open) polled " : "polled ", &polled);
+    put(" sleep ", &slept);
+    serial_eol();
+    _delay_ms(1000);
+  }
+}
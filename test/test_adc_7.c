@@ -0,0 +1,97 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include "pt.h"
+#include "pt-delay.h"
+#include "ticker.h"
+#include "serial.h"
+#include "test_fixture.h"
+#include "adc.h"
+
+/*
+ * Oversamples the potentiometer (10 bits) every second with k extra
+ * bits. k is set sending a digit '0'..'6' through the serial port.
+ * Prints k, the oversampled value (10+k bits), whether a request is
+ * refused while a scan runs (it must be 0) and the scan value.
+ */
+
+
+static adc_channel pot;
+static uint8_t k = 2;
+
+
+static void put(uint16_t v) {
+  while (!serial_can_write());
+  serial_write_ui(v);
+  while (!serial_can_write());
+  serial_write(' ');
+}
+
+
+PT_THREAD(configure(struct pt *pt))
+{
+  static uint8_t c;
+
+  PT_BEGIN(pt);
+
+  for(;;) {
+    PT_WAIT_UNTIL(pt, serial_can_read());
+    c = serial_read();
+    if (c >= '0' && c <= '0' + ADC_OS_MAX_K)
+      k = c - '0';
+  }
+
+  PT_END(pt);
+}
+
+
+PT_THREAD(report(struct pt *pt))
+{
+  static adc_os_t os;
+  static bool accepted;
+
+  PT_BEGIN(pt);
+
+  for(;;) {
+    PT_DELAY(pt, 100);
+    (void)adc_os_start(&os, pot, k);
+    PT_WAIT_WHILE(pt, adc_os_running(&os));
+    put(k);
+    put(adc_os_get(&os));
+
+    /* the scan owns the adc: requests are refused */
+    adc_scan_start(&pot, 1);
+    PT_WAIT_UNTIL(pt, adc_scan_seq(0) > 0);
+    accepted = adc_os_start(&os, pot, k);
+    adc_scan_stop();
+    put(accepted);
+    put(adc_scan_get(0, NULL));
+    while (!serial_can_write());
+    serial_eol();
+  }
+
+  PT_END(pt);
+}
+
+
+int main(void) {
+  struct pt configure_ctx, report_ctx;
+
+  ticker_setup();
+  ticker_start();
+  serial_setup();
+  adc_setup();
+  sei();
+  serial_open();
+
+  pot = adc_bind(POT_CHANNEL | ADC_10BIT, POT_REFERENCE);
+
+  PT_INIT(&configure_ctx);
+  PT_INIT(&report_ctx);
+  for(;;) {
+    (void)PT_SCHEDULE(configure(&configure_ctx));
+    (void)PT_SCHEDULE(report(&report_ctx));
+  }
+}
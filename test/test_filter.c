@@ -0,0 +1,89 @@
+#include <stdint.h>
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include "pt.h"
+#include "ticker.h"
+#include "serial.h"
+#include "test_fixture.h"
+#include "adc.h"
+#include "filter.h"
+
+/*
+ * Samples the potentiometer (10 bits) at 1 kS/s and filters every
+ * sample as it arrives. Every 500 samples prints the last raw value
+ * and the boxcar, IIR, median and biquad outputs.
+ */
+
+#define RATE 1000
+#define BLOCK 500
+
+/* 2nd order Butterworth low pass, fc = 10 Hz at 1 kS/s. b rounded
+ * so that b0 + b1 + b2 == 1 + a1 + a2: unity DC gain */
+static const filter_biquad_coefs_t lp10 = {
+  15, 32, 15,
+  FILTER_Q14(-1.91119707), FILTER_Q14(0.91497583)
+};
+
+
+static void put(uint16_t v) {
+  while (!serial_can_write());
+  serial_write_ui(v);
+  while (!serial_can_write());
+  serial_write(' ');
+}
+
+
+PT_THREAD(filtering(struct pt *pt))
+{
+  static filter_box_t box;
+  static filter_iir_t iir;
+  static filter_median_t med;
+  static filter_biquad_t bq;
+  static uint16_t n, x;
+  static uint16_t y[4];
+
+  PT_BEGIN(pt);
+
+  PT_WAIT_UNTIL(pt, adc_stream_available());
+  x = adc_stream_get();
+  filter_box_init(&box, x);
+  filter_iir_init(&iir, 4, x);
+  filter_median_init(&med, x);
+  filter_biquad_init(&bq, &lp10, x);
+
+  for(;;) {
+    for (n = 0; n < BLOCK; n++) {
+      PT_WAIT_UNTIL(pt, adc_stream_available());
+      x = adc_stream_get();
+      y[0] = filter_box(&box, x);
+      y[1] = filter_iir(&iir, x);
+      y[2] = filter_median(&med, x);
+      y[3] = filter_biquad(&bq, x);
+    }
+    put(x);
+    for (n = 0; n < 4; n++) put(y[n]);
+    while (!serial_can_write());
+    serial_eol();
+  }
+
+  PT_END(pt);
+}
+
+
+int main(void) {
+  struct pt filtering_ctx;
+
+  ticker_setup();
+  ticker_start();
+  serial_setup();
+  adc_setup();
+  sei();
+  serial_open();
+
+  adc_stream_start(adc_bind(POT_CHANNEL | ADC_10BIT, POT_REFERENCE), RATE);
+
+  PT_INIT(&filtering_ctx);
+  for(;;) {
+    (void)PT_SCHEDULE(filtering(&filtering_ctx));
+  }
+}
@@ -0,0 +1,83 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <avr/interrupt.h>
+#include <util/delay.h>
+#include "serial.h"
+#include "filter.h"
+
+/*
+ * Feeds every filter with a synthetic sequence of steps, 10 bits
+ * samples, and checks that its output settles near the new level:
+ * from SETTLE samples after a step on, the output must stay within
+ * TOL LSB of it. Large steps, one LSB steps and full scale steps are
+ * fed. Results are printed over the serial port.
+ */
+
+#define SETTLE 300
+#define HOLD   1000
+#define TOL    2
+
+/* 2nd order Butterworth low pass, fc = 10 Hz at 1 kS/s. b rounded
+ * so that b0 + b1 + b2 == 1 + a1 + a2: unity DC gain */
+static const filter_biquad_coefs_t lp10 = {
+  15, 32, 15,
+  FILTER_Q14(-1.91119707), FILTER_Q14(0.91497583)
+};
+
+static const uint16_t steps[] = {500, 600, 300, 301, 300, 0, 1023, 512};
+#define STEPS (sizeof(steps) / sizeof(steps[0]))
+
+#define FILTERS 4
+static char *const names[FILTERS] = {"box", "iir", "median", "biquad"};
+
+
+int main() {
+  filter_box_t box;
+  filter_iir_t iir;
+  filter_median_t med;
+  filter_biquad_t bq;
+  uint16_t worst[FILTERS];
+  int16_t y[FILTERS];
+
+  serial_setup();
+  sei();
+
+  serial_open();
+  _delay_ms(300);
+  serial_write_s("== begin test\n");
+
+  for (;;) {
+    filter_box_init(&box, steps[0]);
+    filter_iir_init(&iir, 4, steps[0]);
+    filter_median_init(&med, steps[0]);
+    filter_biquad_init(&bq, &lp10, steps[0]);
+    for (uint8_t f = 0; f < FILTERS; f++) worst[f] = 0;
+
+    for (uint8_t s = 1; s < STEPS; s++) {
+      const uint16_t x = steps[s];
+
+      for (uint16_t n = 0; n < HOLD; n++) {
+	y[0] = filter_box(&box, x);
+	y[1] = filter_iir(&iir, x);
+	y[2] = filter_median(&med, x);
+	y[3] = filter_biquad(&bq, x);
+	if (n < SETTLE) continue;
+	for (uint8_t f = 0; f < FILTERS; f++) {
+	  const uint16_t d = abs(y[f] - (int16_t)x);
+	  if (d > worst[f]) worst[f] = d;
+	}
+      }
+    }
+
+    for (uint8_t f = 0; f < FILTERS; f++) {
+      serial_write_s(names[f]);
+      serial_write_s(" worst ");
+      serial_write_ui(worst[f]);
+      serial_write_s(worst[f] <= TOL ? " pass" : " FAIL");
+      serial_eol();
+    }
+    _delay_ms(1000);
+  }
+
+  return 0;
+}
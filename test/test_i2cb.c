@@ -0,0 +1,38 @@
+#include <stdint.h>
+#include <avr/interrupt.h>
+#include "pt.h"
+#include "serial.h"
+#include "i2c.h"
+#include "i2cb.h"
+
+/*
+ * i2c over serial bridge. A host drives the i2c bus sending frames
+ * through the serial port (see i2cb.h). For instance, the frame
+ *
+ *   a5 02  57 68 02 00 00 00  58 68 01 07 00
+ *
+ * resets the seconds register of an RTC DS1307 at 0x68 and reads its
+ * seven time registers.
+ */
+
+
+int main() {
+  struct pt bridge_ctx;
+
+  serial_setup();
+  i2c_setup();
+  sei();
+
+  serial_open();
+  i2c_open();
+
+  PT_INIT(&bridge_ctx);
+  for(;;) {
+    (void)PT_SCHEDULE(i2cb_run(&bridge_ctx));
+  }
+
+  i2c_close();
+  serial_close();
+
+  return 0;
+}
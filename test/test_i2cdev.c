@@ -0,0 +1,126 @@
+#include <stdint.h>
+#include <avr/interrupt.h>
+#include <util/delay.h>
+#include "pt.h"
+#include "serial.h"
+#include "ticker.h"
+#include "i2c.h"
+#include "i2cdev.h"
+
+/*
+ * Drives a DS1307 real time clock as a register based device. The
+ * time registers (0..6) change by themselves, so they are uncacheable;
+ * the control register (7) is cacheable.
+ *
+ * The clock is started by clearing the CH bit of the seconds register
+ * (an uncacheable read-modify-write) and the square wave output is
+ * set to 1 Hz (a cacheable modify, a single write). Setting it again
+ * issues no write. Then the seconds are printed every second while
+ * another protothread keeps blinking the led: modifications do not
+ * block the scheduler. Results are printed over the serial port.
+ */
+
+#define RTC_ADDRESS (0x68)
+#define RTC_REGS    8
+#define RTC_SECONDS 0x00
+#define RTC_CONTROL 0x07
+#define CH          0x80     // clock halt bit of the seconds register
+#define SQW_1HZ     0x10     // SQWE set, RS1:0 cleared
+#define SQW_MASK    0x13
+
+
+static uint8_t shadow[RTC_REGS];
+static const uint8_t uncached[I2CDEV_MAP_SIZE(RTC_REGS)] = {0x7f};
+static i2cdev_t rtc;
+
+
+static void report(char *what, i2c_status_t st) {
+  serial_write_s(what);
+  serial_write_s(st == Success ? " ok " : " FAIL ");
+  serial_write_ui(st);
+  serial_eol();
+}
+
+
+PT_THREAD(test(struct pt *pt))
+{
+  static struct pt child;
+  static i2c_status_t r;
+  static volatile i2c_status_t st;
+  static uint8_t sec;
+  static uint16_t t;
+
+  PT_BEGIN(pt);
+
+  i2cdev_load(&rtc, 0, RTC_REGS, &st);
+  PT_WAIT_WHILE(pt, st == Running);
+  report("load", st);
+
+  PT_SPAWN(pt, &child,
+	   i2cdev_modify(&child, &rtc, RTC_SECONDS, CH, 0, &r));
+  report("start clock", r);
+
+  PT_SPAWN(pt, &child,
+	   i2cdev_modify(&child, &rtc, RTC_CONTROL, SQW_MASK, SQW_1HZ, &r));
+  report("sqw 1Hz", r);
+
+  PT_SPAWN(pt, &child,
+	   i2cdev_modify(&child, &rtc, RTC_CONTROL, SQW_MASK, SQW_1HZ, &r));
+  report("sqw again (no write)", r);
+
+  for (;;) {
+    t = ticker_get();
+    PT_WAIT_WHILE(pt, (uint16_t)(ticker_get() - t) < ticker_tps());
+    i2cdev_read(&rtc, RTC_SECONDS, &sec, &st);
+    PT_WAIT_WHILE(pt, st == Running);
+    serial_write_s("seconds ");
+    serial_write_ui(sec >> 4 & 07);
+    serial_write_ui(sec & 0x0f);
+    serial_eol();
+  }
+
+  PT_END(pt);
+}
+
+
+PT_THREAD(blink(struct pt *pt))
+{
+  static uint16_t t;
+
+  PT_BEGIN(pt);
+
+  for (;;) {
+    t = ticker_get();
+    PT_WAIT_WHILE(pt, (uint16_t)(ticker_get() - t) < ticker_tps() / 4);
+    PINB = _BV(PINB5);
+  }
+
+  PT_END(pt);
+}
+
+
+int main() {
+  struct pt test_ctx, blink_ctx;
+
+  DDRB |= _BV(DDB5);
+  serial_setup();
+  ticker_setup();
+  i2c_setup();
+  sei();
+
+  serial_open();
+  ticker_start();
+  i2c_open();
+  _delay_ms(300);
+  serial_write_s("== begin test\n");
+
+  i2cdev_bind(&rtc, RTC_ADDRESS, shadow, RTC_REGS, uncached);
+  PT_INIT(&test_ctx);
+  PT_INIT(&blink_ctx);
+  for(;;) {
+    (void)PT_SCHEDULE(test(&test_ctx));
+    (void)PT_SCHEDULE(blink(&blink_ctx));
+  }
+
+  return 0;
+}
@@ -0,0 +1,79 @@
+#include <stdint.h>
+#include <avr/interrupt.h>
+#include <util/delay.h>
+#include "pt.h"
+#include "serial.h"
+#include "i2c.h"
+#include "i2cee.h"
+
+/*
+ * Writes a 200 bytes pattern into a 24LC256 at an address that is not
+ * page aligned, reads it back and checks it. Results are printed over
+ * the serial port.
+ */
+
+#define EE_ADDRESS (0x50)
+#define EE_MEMADDR (0x0123)
+#define LEN        200
+
+
+static i2cee_t ee;
+static uint8_t wbuf[LEN], rbuf[LEN];
+
+
+PT_THREAD(test(struct pt *pt))
+{
+  static struct pt child;
+  static i2c_status_t st;
+  static uint8_t pass;
+
+  PT_BEGIN(pt);
+
+  for (pass = 0; ; pass++) {
+    for (uint8_t i = 0; i < LEN; i++) wbuf[i] = i + pass;
+
+    PT_SPAWN(pt, &child,
+	     i2cee_write(&child, &ee, EE_MEMADDR, wbuf, LEN, &st));
+    serial_write_s("write ");
+    serial_write_ui(st);
+
+    PT_SPAWN(pt, &child,
+	     i2cee_read(&child, &ee, EE_MEMADDR, rbuf, LEN, &st));
+    serial_write_s(" read ");
+    serial_write_ui(st);
+
+    serial_write_s(" check ");
+    for (uint8_t i = 0; i < LEN; i++) {
+      if (rbuf[i] != wbuf[i]) {
+	serial_write_s("failed at ");
+	serial_write_ui(i);
+	break;
+      }
+    }
+    serial_eol();
+  }
+
+  PT_END(pt);
+}
+
+
+int main() {
+  struct pt test_ctx;
+
+  serial_setup();
+  i2c_setup();
+  sei();
+
+  serial_open();
+  i2c_open();
+  _delay_ms(300);
+  serial_write_s("== begin test\n");
+
+  i2cee_bind(&ee, EE_ADDRESS, I2CEE_PAGE_24LC256);
+  PT_INIT(&test_ctx);
+  for(;;) {
+    (void)PT_SCHEDULE(test(&test_ctx));
+  }
+
+  return 0;
+}
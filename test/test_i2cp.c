@@ -0,0 +1,62 @@
+#include <stdint.h>
+#include <avr/interrupt.h>
+#include <util/delay.h>
+#include "serial.h"
+#include "i2c.h"
+#include "i2cp.h"
+
+/*
+ * Polls the seconds register of an RTC DS1307 at 10 Hz and its whole
+ * time registers at 1 Hz. Prints fresh samples over serial port.
+ */
+
+#define RTC_ADDRESS (0x68)
+
+
+int main() {
+  i2cp_slot_t secs, time;
+  uint8_t buf[I2CP_SAMPLE_L];
+
+  serial_setup();
+  i2c_setup();
+  i2cp_setup();
+  sei();
+
+  serial_open();
+  i2c_open();
+  _delay_ms(300);
+  serial_write_s("== begin test\n");
+
+  secs = i2cp_add(RTC_ADDRESS, (uint8_t[]){0}, 1, 1, 100);
+  time = i2cp_add(I2C_URGENT(RTC_ADDRESS), (uint8_t[]){0}, 1, 3, 1000);
+  i2cp_start();
+
+  for(;;) {
+    if (i2cp_fresh(secs)) {
+      if (i2cp_get(secs, buf) == Success) {
+	serial_write_s("s ");
+	serial_write_ui(buf[0]);
+	serial_eol();
+      }
+    }
+    if (i2cp_fresh(time)) {
+      if (i2cp_get(time, buf) == Success) {
+	serial_write_s("t ");
+	serial_write_ui(buf[2]);
+	serial_write(':');
+	serial_write_ui(buf[1]);
+	serial_write(':');
+	serial_write_ui(buf[0]);
+	serial_write_s(" skipped ");
+	serial_write_ui(i2cp_skipped(secs));
+	serial_eol();
+      }
+    }
+  }
+
+  i2cp_stop();
+  i2c_close();
+  serial_close();
+
+  return 0;
+}
@@ -0,0 +1,73 @@
+#include <stdint.h>
+#include <avr/interrupt.h>
+#include <util/delay.h>
+#include "serial.h"
+#include "i2c.h"
+#include "i2cp.h"
+
+/*
+ * The foreground and the i2cp timer ISR submit to the same (normal)
+ * priority class at the same time. The seconds register of an RTC
+ * DS1307 is polled every ms while the foreground writes bursts of
+ * bytes, longer than the queue, to the RTC RAM. Every request must
+ * end: no status can stay Running. Prints per burst the writes
+ * ended ok, failed and stuck, and the samples skipped by i2cp.
+ */
+
+#define RTC_ADDRESS (0x68)
+#define RTC_RAM     (0x08)
+#define BURST       24
+#define TIMEOUT_MS  1000
+
+
+int main() {
+  volatile i2c_status_t st[BURST];
+  i2cp_slot_t secs;
+  uint8_t ok, failed, stuck;
+  uint16_t ms;
+
+  serial_setup();
+  i2c_setup();
+  i2cp_setup();
+  sei();
+
+  serial_open();
+  i2c_open();
+  _delay_ms(300);
+  serial_write_s("== begin test\n");
+
+  secs = i2cp_add(RTC_ADDRESS, (uint8_t[]){0}, 1, 1, 1);
+  i2cp_start();
+
+  for (uint8_t pass = 0; ; pass++) {
+    for (uint8_t i = 0; i < BURST; i++)
+      i2c_send_2uint8(RTC_ADDRESS, RTC_RAM + i, pass + i, &st[i]);
+
+    // wait for every request to end, with a timeout
+    for (ms = 0; ms < TIMEOUT_MS; ms++) {
+      uint8_t i = 0;
+      while (i < BURST && st[i] != Running) i++;
+      if (i == BURST) break;
+      _delay_ms(1);
+    }
+
+    ok = failed = stuck = 0;
+    for (uint8_t i = 0; i < BURST; i++) {
+      if (st[i] == Success) ok++;
+      else if (st[i] == Running) stuck++;
+      else failed++;
+    }
+    serial_write_s("ok ");
+    serial_write_ui(ok);
+    serial_write_s(" failed ");
+    serial_write_ui(failed);
+    serial_write_s(" stuck ");
+    serial_write_ui(stuck);
+    serial_write_s(" skipped ");
+    serial_write_ui(i2cp_skipped(secs));
+    serial_write_s(stuck ? " FAIL" : " pass");
+    serial_eol();
+  }
+
+  return 0;
+}
@@ -0,0 +1,55 @@
+#include <stdint.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include "ticker.h"
+#include "test_fixture.h"
+#include "i2cs.h"
+
+/*
+ * Acts as an i2c co-processor at address 0x42. Register map:
+ *  0:   (rw) semaphore 1 leds: bit 0 red, bit 1 yellow, bit 2 green
+ *  1-2: (ro) ticker value, little endian
+ */
+
+#define OWN_ADDRESS (0x42)
+
+static volatile uint8_t regs[3];
+static volatile bool leds_changed;
+
+
+static void on_write(uint8_t first, uint8_t n) {
+  if (first == 0 && n > 0)
+    leds_changed = true;
+}
+
+
+int main() {
+  fixture_setup();
+  ticker_setup();
+  i2cs_setup(OWN_ADDRESS);
+  sei();
+
+  ticker_start();
+  i2cs_open(regs, sizeof(regs), 1, on_write);
+
+  for(;;) {
+    uint16_t t = ticker_get();
+
+    /* publish multibyte values atomically */
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      regs[1] = t & 0xff;
+      regs[2] = t >> 8;
+    }
+
+    if (leds_changed) {
+      leds_changed = false;
+      if (regs[0] & 1) led_on(semaph1, red);    else led_off(semaph1, red);
+      if (regs[0] & 2) led_on(semaph1, yellow); else led_off(semaph1, yellow);
+      if (regs[0] & 4) led_on(semaph1, green);  else led_off(semaph1, green);
+    }
+  }
+
+  i2cs_close();
+
+  return 0;
+}
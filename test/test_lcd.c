@@ -1,5 +1,8 @@
 #include <avr/io.h>
+#include <avr/interrupt.h>
 #include <util/delay.h>
+#include "pt.h"
+#include "i2c.h"
 #include "lcd.h"
 #include "charmaps.h"
 
@@ -12,8 +15,19 @@
 #define LBL_DIVIDERS "       |     |"
 */
 
+#define LCD_ADDRESS (0x27)
+
+
 int main() {
-  lcd_t lcd = lcd_bind(&PORTD,4,5);
+  struct pt refresh_ctx;
+  lcd_t lcd;
+  uint8_t n = 0;
+
+  i2c_setup();
+  sei();
+  i2c_open();
+
+  lcd = lcd_bind(LCD_ADDRESS, 20, 4);
   lcd_on(lcd);
   lcd_disable_autoscroll(lcd);
   lcd_clear(lcd);
@@ -28,12 +42,19 @@ int main() {
   lcd_move_cursor(lcd,2,2);
   lcd_print(lcd, "EPSEM RESPIRATOR");
 
-  for(;;);
+  /* a counter: only its cell is sent on every refresh */
+  PT_INIT(&refresh_ctx);
+  for(;;) {
+    (void)PT_SCHEDULE(lcd_refresh(&refresh_ctx, lcd));
+    lcd_move_cursor(lcd,19,3);
+    lcd_send(lcd,LCD_DATA,'0' + n);
+    n = (n + 1) % 10;
+    _delay_ms(100);
+  }
 
   return 0;
 }
 
-
 /*
 void setLabels(void){
   lcd_clear();